@@ -4,6 +4,7 @@
 #include <pthread.h>
 #include "Utils.h"
 #include "Picture.h"
+#include "PicProcess.h"
 #include "BlurExprmt.h"
 #include <math.h>
 #include <stdlib.h>
@@ -17,7 +18,6 @@
 #define PTHREAD_CREATE_FAIL_CODE 1
 #define PTHREAD_CREATE_SUCCESS_CODE 0
 #define BOUNDARY_WIDTH 1
-#define MEMORY_ERROR -2
 #define CORE_NUM_FOR_TESTING 6
 #define BILLION 1000000000.0
 #define MILLION 1000000.0
@@ -56,8 +56,7 @@ make
     // Sequential Version that was given is known to be correct so
     // It is used as a baseline for comparisons
     struct picture correct_blur;
-    init_picture_from_size(&correct_blur, pic->width, pic->height);
-    correct_blur.img = copy_image(pic->img);
+    copy_picture(&correct_blur, pic);
     sequential_blur(&correct_blur);
 
 
@@ -82,11 +81,13 @@ make
 
       fprintf(fp, "Time Spent per Attempt (milliseconds): ");
 
+      // count the picture buffers this function allocates and recycles
+      reset_buffer_pool_stats();
+
       for (int iter = 0; iter < number_of_tests; iter++) {
 
         struct picture pic_for_test;
-        init_picture_from_size(&pic_for_test, pic->width, pic->height);
-        pic_for_test.img = copy_image(pic->img);
+        copy_picture(&pic_for_test, pic);
 
         // Begins clock at current tick number
         struct timespec start;
@@ -146,6 +147,11 @@ make
       fprintf(fp, "   Slowest Time: %f ms \n", slowest_time);
       fprintf(fp, "   Fastest Time: %f ms \n", fastest_time);
 
+      struct buffer_pool_stats pool_stats = get_buffer_pool_stats();
+      fprintf(fp, "   Buffers Allocated: %zu \n", pool_stats.allocations);
+      fprintf(fp, "   Buffers Reused: %zu (%f MB not reallocated) \n", 
+              pool_stats.reuses, pool_stats.bytes_reused / MILLION);
+
       // Padding for next function tests
       fprintf(fp, "\n\n\n");
     }
@@ -156,6 +162,7 @@ make
     fclose(fp);
 
     clear_picture(&correct_blur);
+    drain_buffer_pool();
 
   }
 
@@ -184,12 +191,43 @@ make
       column_blur(pic);
     }
 
+  void box_blur_testwrapper(struct picture *pic, const char *unused){
+      printf("calling box blur\n");
+      box_blur_picture(pic);
+    }
+
+  void simd_blur_testwrapper(struct picture *pic, const char *unused){
+      printf("calling simd blur (%s)\n", simd_blur_isa());
+      simd_blur_picture(pic);
+    }
+
+  void integral_blur_testwrapper(struct picture *pic, const char *unused){
+      printf("calling integral blur\n");
+      integral_blur_picture(pic, BOUNDARY_WIDTH);
+    }
+
+  void inplace_blur_testwrapper(struct picture *pic, const char *unused){
+      printf("calling in-place blur\n");
+      inplace_blur_picture(pic);
+    }
+
+  void tiled_blur_testwrapper(struct picture *pic, const char *unused){
+      printf("calling tiled blur\n");
+      // one thread per core
+      tiled_blur_picture(pic, 0);
+    }
+
   static void (* const cmds[])(struct picture *, const char *) = { 
     sequential_blur_testwrapper,
     pixel_by_pixel_blur_testwrapper,
     sector_core_blur_testwrapper,
     row_blur_testwrapper,
     column_blur_testwrapper,
+    box_blur_testwrapper,
+    simd_blur_testwrapper,
+    integral_blur_testwrapper,
+    inplace_blur_testwrapper,
+    tiled_blur_testwrapper,
   };
 
   // list of all possible picture transformations
@@ -199,6 +237,11 @@ make
     "sector-core-blur",
     "row-blur",
     "column-blur",
+    "box-blur",
+    "simd-blur",
+    "integral-blur",
+    "inplace-blur",
+    "tiled-blur",
   };
 
   static int no_of_cmds = sizeof(cmds) / sizeof(cmds[0]);
@@ -242,42 +285,6 @@ make
 
 
 
-  static void get_avg_pixel_and_set(struct picture* orig_pic,
-                                struct picture* new_pic,
-                                int x_coord, int y_coord) {
-    // set-up a local pixel on the stack
-    struct pixel rgb = get_pixel(orig_pic, x_coord, y_coord);
-    
-    // don't need to modify boundary pixels
-    if(x_coord != 0 && y_coord != 0 && 
-        x_coord != orig_pic->width - BOUNDARY_WIDTH && 
-        y_coord != orig_pic->height - BOUNDARY_WIDTH) {
-    
-      // set up running RGB component totals for pixel region
-      int sum_red = rgb.red;
-      int sum_green = rgb.green;
-      int sum_blue = rgb.blue;
-  
-      // check the surrounding pixel region (provided code)
-      for(int n = -1; n <= 1; n++){
-        for(int m = -1; m <= 1; m++){
-          if(n != 0 || m != 0){
-            rgb = get_pixel(orig_pic, x_coord+n, y_coord+m);
-            sum_red += rgb.red;
-            sum_green += rgb.green;
-            sum_blue += rgb.blue;
-          }
-        }
-      }
-  
-      // compute average pixel RGB value
-      rgb.red = sum_red / BLUR_REGION_SIZE;
-      rgb.green = sum_green / BLUR_REGION_SIZE;
-      rgb.blue = sum_blue / BLUR_REGION_SIZE;
-    }
-    set_pixel(new_pic, x_coord, y_coord, &rgb);
-  }
-
   static void thread_cleanup_handler(void* args)
   {
       free(args);
@@ -333,10 +340,31 @@ make
 
 
 
+  // store a blurred pixel, aborting if the picture refuses the write (the
+  // new pictures here are owned, upright and of the source's format, so 
+  // a refusal means a picture was not prepared before blurring)
+  static void store_pixel(struct picture *pic, int x, int y, 
+                          struct pixel *rgb){
+    if(!set_pixel(pic, x, y, rgb)){
+      printf("[!] could not write pixel (%i,%i) of the blurred picture\n", 
+             x, y);
+      exit(IO_ERROR);
+    }
+  }
+
+  // make a new picture of pic's size and format for a blur to write into,
+  // aborting if there is no memory for one
+  static void init_blurred(struct picture *tmp, struct picture *pic){
+    if(!init_picture_for_overwrite(tmp, pic->width, pic->height, pic->bpp)){
+      printf("[!] out of memory for the blurred picture\n");
+      exit(MEMORY_ERROR);
+    }
+  }
+
   void sequential_blur(struct picture *pic){
     // make new temporary picture to work in
     struct picture tmp;
-    init_picture_from_size(&tmp, pic->width, pic->height);
+    init_blurred(&tmp, pic);
   
     // iterate over each pixel in the picture
     for(int i = 0 ; i < tmp.width; i++){
@@ -372,7 +400,7 @@ make
         }
       
         // set pixel to computed region RBG value (unmodified if boundary)
-        set_pixel(&tmp, i, j, &rgb);
+        store_pixel(&tmp, i, j, &rgb);
       }
     }
     
@@ -409,7 +437,7 @@ make
     rgb.green = sum_green / BLUR_REGION_SIZE;
     rgb.blue = sum_blue / BLUR_REGION_SIZE;
 
-    set_pixel(pargs->new_pic, pargs->x_coord, pargs->y_coord, &rgb);
+    store_pixel(pargs->new_pic, pargs->x_coord, pargs->y_coord, &rgb);
 
     pthread_cleanup_pop(1);
   }
@@ -420,7 +448,7 @@ make
 
     struct pixel rgb = 
       get_pixel(pargs->orig_pic, pargs->x_coord, pargs->y_coord);
-    set_pixel(pargs->new_pic, pargs->x_coord, pargs->y_coord, &rgb);
+    store_pixel(pargs->new_pic, pargs->x_coord, pargs->y_coord, &rgb);
 
     pthread_cleanup_pop(1);
   }
@@ -439,9 +467,17 @@ make
   }
 
   void pixel_by_pixel_blur(struct picture *pic){
-    // make new temporary picture to work in
+    // settle any pending rotation before the workers start reading, so 
+    // every get_pixel is a plain load from the stored layout
+    if(!picture_apply_orientation(pic)){
+      printf("[!] out of memory orienting picture for pixel workers\n");
+      exit(MEMORY_ERROR);
+    }
+
+    // make new temporary picture to work in (owned, upright and the same 
+    // format as the source, so the workers' writes are never refused)
     struct picture tmp;
-    init_picture_from_size(&tmp, pic->width, pic->height);
+    init_blurred(&tmp, pic);
 
     struct thread_queue thread_store;
     init_queue(&thread_store);
@@ -494,12 +530,7 @@ make
   static void *sector_pixel_worker(void *args) {
     struct sector_work_args *pargs = args;
 
-    for(int x_coord = pargs->start_x; x_coord < pargs->end_x; x_coord++){
-      for(int y_coord = pargs->start_y; y_coord < pargs->end_y; y_coord++){
-        get_avg_pixel_and_set(pargs->orig_pic, pargs->new_pic, 
-                            x_coord, y_coord);
-      }
-    }
+    blur_view_into(&pargs->orig_view, &pargs->new_view);
   }
 
   // All sectors are split vertically
@@ -510,36 +541,43 @@ make
       exit(IO_ERROR);
     }
 
-    // make new temporary picture to work in
-    struct picture tmp;
-    init_picture_from_size(&tmp, pic->width, pic->height);
-
-    int sector_width = floor(pic->width / num_cores);
-
-    pthread_t sector_threads[num_cores];
-
     struct sector_work_args *sector_worker_args = 
       malloc(sizeof(struct sector_work_args) * num_cores);
-
     if (sector_worker_args == NULL) {
+      printf("[!] out of memory for %i sector workers\n", num_cores);
       exit(MEMORY_ERROR);
     }
 
+    // make new temporary picture to work in
+    struct picture tmp;
+    init_blurred(&tmp, pic);
+
+    // sectors are a whole number of cache lines wide so that no two 
+    // threads ever write to the same cache line of the new picture
+    int line_pixels = picture_line_pixels(&tmp);
+    int sector_width = (pic->width + num_cores - 1) / num_cores;
+    sector_width = (sector_width + line_pixels - 1) / line_pixels * line_pixels;
+
+    pthread_t sector_threads[num_cores];
+
     // Main loop to create all threads
     // creates thread arguments
     for (int sector_num = 0; sector_num<num_cores; sector_num++) {
       struct sector_work_args *pargs = &sector_worker_args[sector_num];
-      pargs->orig_pic = pic;
-      pargs->new_pic = &tmp;
-      pargs->start_x = sector_num * sector_width;
-      if (sector_num + 1 == num_cores) {
-        pargs->end_x = tmp.width;
-      } else {
-        pargs->end_x = (sector_num + 1) * sector_width;
+      int start_x = sector_num * sector_width;
+      int end_x = start_x + sector_width;
+      if (start_x > tmp.width) {
+        start_x = tmp.width;
+      }
+      if (end_x > tmp.width || sector_num + 1 == num_cores) {
+        end_x = tmp.width;
       }
       
-      pargs->start_y = 0; //top of the image
-      pargs->end_y = tmp.height;
+      // each sector spans the full height of the image
+      init_picture_view(&pargs->orig_view, pic, 
+                        start_x, 0, end_x - start_x, tmp.height);
+      init_picture_view(&pargs->new_view, &tmp, 
+                        start_x, 0, end_x - start_x, tmp.height);
 
       pthread_create(&sector_threads[sector_num], NULL,
                     sector_pixel_worker,
@@ -567,10 +605,11 @@ make
                     struct picture *orig_pic, struct picture *new_pic, 
                     int row_num, struct thread_queue* queue) {
     struct row_work_args *row_params  = 
-          malloc_clear_if_need(sizeof(struct pixel_work_args), queue);
-    row_params->orig_pic = orig_pic;
-    row_params->new_pic = new_pic;
-    row_params->row_num = row_num;
+          malloc_clear_if_need(sizeof(struct row_work_args), queue);
+    init_picture_view(&row_params->orig_view, orig_pic, 
+                      0, row_num, orig_pic->width, 1);
+    init_picture_view(&row_params->new_view, new_pic, 
+                      0, row_num, new_pic->width, 1);
 
     make_thread_and_enqueue(worker_func, row_params, queue);
   }
@@ -580,11 +619,8 @@ make
 
     struct row_work_args *pargs = (struct row_work_args*) args;
 
-    // iterate over each pixel in the row
-    for(int x_coord = 0; x_coord < pargs->new_pic->width; x_coord++) {
-      get_avg_pixel_and_set(pargs->orig_pic, pargs->new_pic, 
-                            x_coord, pargs->row_num);
-    }
+    // blur each pixel in the row
+    blur_view_into(&pargs->orig_view, &pargs->new_view);
 
     pthread_cleanup_pop(1);
   }
@@ -592,7 +628,7 @@ make
   void row_blur(struct picture *pic){
     // make new temporary picture to work in
     struct picture tmp;
-    init_picture_from_size(&tmp, pic->width, pic->height);
+    init_blurred(&tmp, pic);
 
     struct thread_queue thread_store;
     init_queue(&thread_store);
@@ -621,10 +657,11 @@ make
                     struct picture *orig_pic, struct picture *new_pic, 
                     int column_num, struct thread_queue* queue) {
     struct column_work_args *column_params  = 
-          malloc_clear_if_need(sizeof(struct pixel_work_args), queue);
-    column_params->orig_pic = orig_pic;
-    column_params->new_pic = new_pic;
-    column_params->column_num = column_num;
+          malloc_clear_if_need(sizeof(struct column_work_args), queue);
+    init_picture_view(&column_params->orig_view, orig_pic, 
+                      column_num, 0, 1, orig_pic->height);
+    init_picture_view(&column_params->new_view, new_pic, 
+                      column_num, 0, 1, new_pic->height);
 
     make_thread_and_enqueue(worker_func, column_params, queue);
   }
@@ -635,11 +672,8 @@ make
 
     struct column_work_args *pargs = (struct column_work_args*) args;
 
-    // iterate over each pixel in the column
-    for(int y_coord = 0 ; y_coord < pargs->new_pic->height; y_coord++){
-      get_avg_pixel_and_set(pargs->orig_pic, pargs->new_pic, 
-                            pargs->column_num, y_coord);
-    }
+    // blur each pixel in the column
+    blur_view_into(&pargs->orig_view, &pargs->new_view);
 
     pthread_cleanup_pop(1);
   }
@@ -647,7 +681,7 @@ make
   void column_blur(struct picture *pic){
     // make new temporary picture to work in
     struct picture tmp;
-    init_picture_from_size(&tmp, pic->width, pic->height);
+    init_blurred(&tmp, pic);
 
     struct thread_queue thread_store;
     init_queue(&thread_store);
@@ -678,11 +712,22 @@ make
       return false;
     }
   
-    // iterate over the picture pixel-by-pixel and compare RGB values
-    for(int i = 0; i < width; i++){
-      for(int j = 0; j < height; j++){
-        struct pixel pixel1 = get_pixel(pic1, i, j);
-        struct pixel pixel2 = get_pixel(pic2, i, j);
+    // iterate over the picture row-by-row and compare RGB values
+    struct pixel *row1 = malloc(width * sizeof(struct pixel));
+    struct pixel *row2 = malloc(width * sizeof(struct pixel));
+    if(row1 == NULL || row2 == NULL){
+      printf("[!] fail - out of memory comparing pictures\n");
+      free(row1);
+      free(row2);
+      return false;
+    }
+    bool equal = true;
+    for(int j = 0; j < height && equal; j++){
+      get_pixels(pic1, 0, j, width, row1);
+      get_pixels(pic2, 0, j, width, row2);
+      for(int i = 0; i < width; i++){
+        struct pixel pixel1 = row1[i];
+        struct pixel pixel2 = row2[i];
         
         int red_diff = pixel1.red - pixel2.red;
         int green_diff = pixel1.green - pixel2.green;
@@ -692,9 +737,12 @@ make
           printf("[!] fail - pictures not equal at cell (%i,%i)\n", i ,j);
           printf("    pixel1 RGB = \t(%i,\t %i,\t %i)\n", pixel1.red, pixel1.green, pixel1.blue);
           printf("    pixel2 RGB = \t(%i,\t %i,\t %i)\n", pixel2.red, pixel2.green, pixel2.blue);
-          return false;
+          equal = false;
+          break;
         }
       }
     }
-    return true;
+    free(row1);
+    free(row2);
+    return equal;
   }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "myUtils.h"
+#include "Picture.h"
 
 struct pixel_work_args {
     struct picture *orig_pic;
@@ -8,24 +9,18 @@ struct pixel_work_args {
 };
 
 struct sector_work_args {
-    struct picture *orig_pic;
-    struct picture *new_pic;
-    int start_x;
-    int start_y;
-    int end_x;
-    int end_y;
+    struct picture_view orig_view;
+    struct picture_view new_view;
 };
 
 struct row_work_args {
-    struct picture *orig_pic;
-    struct picture *new_pic;
-    int row_num;
+    struct picture_view orig_view;
+    struct picture_view new_view;
 };
 
 struct column_work_args {
-    struct picture *orig_pic;
-    struct picture *new_pic;
-    int column_num;
+    struct picture_view orig_view;
+    struct picture_view new_view;
 };
 
 void sequential_blur(struct picture *);
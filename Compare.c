@@ -31,11 +31,24 @@
       return 1;
     }
   
-    // iterate over the picture pixel-by-pixel and compare RGB values
-    for(int i = 0; i < width; i++){
-      for(int j = 0; j < height; j++){
-        struct pixel pixel1 = get_pixel(&pic1, i, j);
-        struct pixel pixel2 = get_pixel(&pic2, i, j);
+    // iterate over the picture row-by-row and compare RGB values
+    struct pixel *row1 = malloc(width * sizeof(struct pixel));
+    struct pixel *row2 = malloc(width * sizeof(struct pixel));
+    if(row1 == NULL || row2 == NULL){
+      printf("[!] fail - out of memory comparing pictures\n");
+      free(row1);
+      free(row2);
+      clear_picture(&pic1);
+      clear_picture(&pic2);
+      return IO_ERROR;
+    }
+    bool equal = true;
+    for(int j = 0; j < height && equal; j++){
+      get_pixels(&pic1, 0, j, width, row1);
+      get_pixels(&pic2, 0, j, width, row2);
+      for(int i = 0; i < width; i++){
+        struct pixel pixel1 = row1[i];
+        struct pixel pixel2 = row2[i];
         
         int red_diff = pixel1.red - pixel2.red;
         int green_diff = pixel1.green - pixel2.green;
@@ -45,10 +58,16 @@
           printf("[!] fail - pictures not equal at cell (%i,%i)\n", i ,j);
           printf("    pixel1 RGB = \t(%i,\t %i,\t %i)\n", pixel1.red, pixel1.green, pixel1.blue);
           printf("    pixel2 RGB = \t(%i,\t %i,\t %i)\n", pixel2.red, pixel2.green, pixel2.blue);
-          return 1;
+          equal = false;
+          break;
         }
       }
     }
+    free(row1);
+    free(row2);
+    if(!equal){
+      return 1;
+    }
   
     printf("success - pictures identical!\n");
     return 0;
@@ -0,0 +1,376 @@
+#include "Kernel.h"
+#include <ctype.h>
+#include <math.h>
+#include <string.h>
+
+  // integer kernels whose weights add up to more than this (in magnitude)
+  // are rounded to fixed point like any other, to keep sums within range
+  #define MAX_INTEGER_WEIGHT_TOTAL (1 << 16)
+  // largest magnitude of a fixed-point weight
+  #define MAX_FIXED_POINT_WEIGHT (1 << 24)
+  #define MAX_KERNEL_SIZE (2 * KERNEL_MAX_RADIUS + 1)
+
+  // set the divisor and rounding bias applied to weighted sums
+  static void set_divisor(struct convolution_kernel *kernel, int64_t divisor,
+                          bool round){
+    kernel->divisor = divisor;
+    kernel->bias = round ? divisor / 2 : 0;
+    kernel->shift = -1;
+    if(divisor > 0 && (divisor & (divisor - 1)) == 0){
+      kernel->shift = 0;
+      while(((int64_t) 1 << kernel->shift) < divisor){
+        kernel->shift++;
+      }
+    }
+  }
+
+  // whether all n weights are integers of modest total magnitude
+  static bool has_integer_weights(const double *weights, int n){
+    double total = 0;
+    for(int k = 0; k < n; k++){
+      if(weights[k] != rint(weights[k])){
+        return false;
+      }
+      total += fabs(weights[k]);
+    }
+    return total <= MAX_INTEGER_WEIGHT_TOTAL;
+  }
+
+  // factor size x size weights into column[j] * row[i] if they are the
+  // outer product of two vectors, using the largest weight as the pivot
+  static bool factorise(const double *weights, int size, double *column,
+                        double *row, int *pivot_x, int *pivot_y){
+    int pivot = 0;
+    for(int k = 1; k < size * size; k++){
+      if(fabs(weights[k]) > fabs(weights[pivot])){
+        pivot = k;
+      }
+    }
+    double largest = weights[pivot];
+    *pivot_x = pivot % size;
+    *pivot_y = pivot / size;
+    for(int k = 0; k < size; k++){
+      column[k] = weights[k * size + *pivot_x];
+      row[k] = weights[*pivot_y * size + k] / largest;
+    }
+    for(int j = 0; j < size; j++){
+      for(int i = 0; i < size; i++){
+        if(fabs(weights[j * size + i] - column[j] * row[i]) >
+           1e-9 * fabs(largest)){
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  static int64_t gcd(int64_t a, int64_t b){
+    while(b != 0){
+      int64_t r = a % b;
+      a = b;
+      b = r;
+    }
+    return a < 0 ? -a : a;
+  }
+
+  // factor integer weights into integer column and row vectors, given the
+  // pivot of a real factorisation (fails if no integer factors exist)
+  static bool factorise_integers(const double *weights, int size,
+                                 int pivot_x, int pivot_y, int32_t *column,
+                                 int32_t *row){
+    int64_t common = 0;
+    for(int k = 0; k < size; k++){
+      common = gcd(common, (int64_t) weights[k * size + pivot_x]);
+    }
+    for(int k = 0; k < size; k++){
+      column[k] = (int32_t) (weights[k * size + pivot_x] / common);
+    }
+    for(int k = 0; k < size; k++){
+      int64_t weight = (int64_t) weights[pivot_y * size + k];
+      if(weight % column[pivot_y] != 0){
+        return false;
+      }
+      row[k] = (int32_t) (weight / column[pivot_y]);
+    }
+    for(int j = 0; j < size; j++){
+      for(int i = 0; i < size; i++){
+        if((int64_t) column[j] * row[i] != (int64_t) weights[j * size + i]){
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  // round n weights to fixed point, putting any rounding error into the
+  // largest weight if they should add up to exactly one
+  static bool quantise(const double *weights, int32_t *out, int n,
+                       bool normalised){
+    int64_t total = 0;
+    int largest = 0;
+    for(int k = 0; k < n; k++){
+      double weight = weights[k] * (1 << KERNEL_FRACTION_BITS);
+      if(fabs(weight) > MAX_FIXED_POINT_WEIGHT){
+        return false;
+      }
+      out[k] = (int32_t) lround(weight);
+      total += out[k];
+      if(fabs(weights[k]) > fabs(weights[largest])){
+        largest = k;
+      }
+    }
+    if(normalised){
+      out[largest] += (1 << KERNEL_FRACTION_BITS) - total;
+    }
+    return true;
+  }
+
+  // total magnitude of n fixed-point weights
+  static int64_t weight_total(const int32_t *weights, int n){
+    int64_t total = 0;
+    for(int k = 0; k < n; k++){
+      total += weights[k] < 0 ? -(int64_t) weights[k] : weights[k];
+    }
+    return total;
+  }
+
+  // set up an integer kernel applied exactly (dividing by the weight sum)
+  static bool init_integer_kernel(struct convolution_kernel *kernel,
+                                  const double *weights, int size,
+                                  double sum, bool separable, int pivot_x,
+                                  int pivot_y){
+    if(separable && factorise_integers(weights, size, pivot_x, pivot_y,
+                                       kernel->column, kernel->row)){
+      kernel->separable = true;
+    } else {
+      for(int k = 0; k < size * size; k++){
+        kernel->weights[k] = (int32_t) weights[k];
+      }
+    }
+    set_divisor(kernel, sum != 0 ? (int64_t) sum : 1, false);
+    return true;
+  }
+
+  // set up a kernel of fixed-point weights
+  static bool init_fixed_point_kernel(struct convolution_kernel *kernel,
+                                      const double *weights, int size,
+                                      double sum, bool separable,
+                                      double *column, double *row){
+    // normalise, splitting the sum between the two factors if separable
+    bool normalised = sum != 0;
+    if(separable && normalised){
+      double column_sum = 0, row_sum = 0;
+      for(int k = 0; k < size; k++){
+        column_sum += column[k];
+        row_sum += row[k];
+      }
+      for(int k = 0; k < size; k++){
+        column[k] /= column_sum;
+        row[k] /= row_sum;
+      }
+    }
+
+    // separable sums are held in 32 bits between the two passes
+    if(separable &&
+       quantise(column, kernel->column, size, normalised) &&
+       quantise(row, kernel->row, size, normalised) &&
+       weight_total(kernel->row, size) * 255 <= INT32_MAX){
+      kernel->separable = true;
+      set_divisor(kernel, (int64_t) 1 << (2 * KERNEL_FRACTION_BITS), true);
+      return true;
+    }
+    double scaled[size * size];
+    for(int k = 0; k < size * size; k++){
+      scaled[k] = normalised ? weights[k] / sum : weights[k];
+    }
+    if(!quantise(scaled, kernel->weights, size * size, normalised)){
+      printf("[!] kernel weights are too large\n");
+      return false;
+    }
+    set_divisor(kernel, (int64_t) 1 << KERNEL_FRACTION_BITS, true);
+    return true;
+  }
+
+  bool init_kernel_from_weights(struct convolution_kernel *kernel,
+                                const double *weights, int size){
+    memset(kernel, 0, sizeof(*kernel));
+    if(size < 1 || size % 2 == 0 || size > MAX_KERNEL_SIZE){
+      printf("[!] kernel must be an odd size between 1 and %i\n",
+             MAX_KERNEL_SIZE);
+      return false;
+    }
+    int n = size * size;
+    kernel->radius = size / 2;
+    kernel->row = malloc(size * sizeof(int32_t));
+    kernel->column = malloc(size * sizeof(int32_t));
+    kernel->weights = malloc(n * sizeof(int32_t));
+    if(kernel->row == NULL || kernel->column == NULL ||
+       kernel->weights == NULL){
+      clear_kernel(kernel);
+      return false;
+    }
+
+    double sum = 0;
+    bool uniform = weights[0] > 0;
+    for(int k = 0; k < n; k++){
+      sum += weights[k];
+      uniform = uniform && weights[k] == weights[0];
+    }
+
+    // a box blur averages exactly, whatever its weights are scaled by
+    if(uniform){
+      kernel->uniform = true;
+      kernel->separable = true;
+      for(int k = 0; k < size; k++){
+        kernel->row[k] = 1;
+        kernel->column[k] = 1;
+      }
+      set_divisor(kernel, n, false);
+      return true;
+    }
+
+    double column[size], row[size];
+    int pivot_x, pivot_y;
+    bool separable = factorise(weights, size, column, row, &pivot_x,
+                               &pivot_y);
+    if(weights[pivot_y * size + pivot_x] == 0){
+      printf("[!] kernel weights must not all be zero\n");
+      clear_kernel(kernel);
+      return false;
+    }
+    bool ok = has_integer_weights(weights, n) ?
+      init_integer_kernel(kernel, weights, size, sum, separable, pivot_x,
+                          pivot_y) :
+      init_fixed_point_kernel(kernel, weights, size, sum, separable, column,
+                              row);
+    if(!ok){
+      clear_kernel(kernel);
+    }
+    return ok;
+  }
+
+  bool init_kernel_from_file(struct convolution_kernel *kernel,
+                             const char *path){
+    FILE *file = fopen(path, "r");
+    if(file == NULL){
+      printf("[!] error reading from file %s (check it exists)\n", path);
+      return false;
+    }
+    double *weights = malloc(MAX_KERNEL_SIZE * MAX_KERNEL_SIZE *
+                             sizeof(double));
+    int n = 0;
+    bool ok = weights != NULL;
+    // weights are read a token at a time, so rows may be of any length 
+    // (a # starts a comment that runs to the end of its line)
+    int c;
+    while(ok && (c = fgetc(file)) != EOF){
+      if(isspace(c)){
+        continue;
+      }
+      if(c == '#'){
+        while(c != '\n' && c != EOF){
+          c = fgetc(file);
+        }
+        continue;
+      }
+      ungetc(c, file);
+      double weight;
+      if(fscanf(file, "%lf", &weight) != 1){
+        printf("[!] kernel file %s holds something other than a weight\n",
+               path);
+        fclose(file);
+        free(weights);
+        return false;
+      }
+      if(n == MAX_KERNEL_SIZE * MAX_KERNEL_SIZE){
+        ok = false;
+        break;
+      }
+      weights[n++] = weight;
+    }
+    fclose(file);
+
+    int size = (int) lround(sqrt(n));
+    if(!ok || n == 0 || size * size != n){
+      printf("[!] kernel file %s must hold an odd square number of weights\n",
+             path);
+      free(weights);
+      return false;
+    }
+    ok = init_kernel_from_weights(kernel, weights, size);
+    free(weights);
+    return ok;
+  }
+
+  bool init_box_kernel(struct convolution_kernel *kernel, int radius){
+    if(radius < 1 || radius > KERNEL_MAX_RADIUS){
+      printf("[!] box kernel is undefined for radius %i (must be 1 to %i)\n",
+             radius, KERNEL_MAX_RADIUS);
+      return false;
+    }
+    int size = 2 * radius + 1;
+    double weights[size * size];
+    for(int k = 0; k < size * size; k++){
+      weights[k] = 1;
+    }
+    return init_kernel_from_weights(kernel, weights, size);
+  }
+
+  bool init_gaussian_kernel(struct convolution_kernel *kernel, double sigma){
+    int radius = (int) ceil(3 * sigma);
+    if(!(sigma > 0) || radius > KERNEL_MAX_RADIUS){
+      printf("[!] gaussian kernel is undefined for sigma %g "
+             "(must be above 0 and at most %i)\n", sigma,
+             KERNEL_MAX_RADIUS / 3);
+      return false;
+    }
+    int size = 2 * radius + 1;
+    double profile[size];
+    for(int k = 0; k < size; k++){
+      double d = k - radius;
+      profile[k] = exp(-d * d / (2 * sigma * sigma));
+    }
+    double weights[size * size];
+    for(int j = 0; j < size; j++){
+      for(int i = 0; i < size; i++){
+        weights[j * size + i] = profile[j] * profile[i];
+      }
+    }
+    return init_kernel_from_weights(kernel, weights, size);
+  }
+
+  bool init_sharpen_kernel(struct convolution_kernel *kernel){
+    static const double weights[] = {
+       0, -1,  0,
+      -1,  5, -1,
+       0, -1,  0
+    };
+    return init_kernel_from_weights(kernel, weights, 3);
+  }
+
+  bool init_kernel_from_spec(struct convolution_kernel *kernel,
+                             const char *spec){
+    if(spec == NULL){
+      printf("[!] no kernel given\n");
+      return false;
+    }
+    if(strncmp(spec, "box:", 4) == 0){
+      return init_box_kernel(kernel, atoi(spec + 4));
+    }
+    if(strncmp(spec, "gaussian:", 9) == 0){
+      return init_gaussian_kernel(kernel, atof(spec + 9));
+    }
+    if(strcmp(spec, "sharpen") == 0){
+      return init_sharpen_kernel(kernel);
+    }
+    return init_kernel_from_file(kernel, spec);
+  }
+
+  void clear_kernel(struct convolution_kernel *kernel){
+    free(kernel->row);
+    free(kernel->column);
+    free(kernel->weights);
+    kernel->row = NULL;
+    kernel->column = NULL;
+    kernel->weights = NULL;
+  }
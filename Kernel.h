@@ -0,0 +1,67 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include "Utils.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+  // largest supported kernel radius (kernels are at most 2 * this + 1 wide)
+  #define KERNEL_MAX_RADIUS 64
+
+  // fractional bits of the fixed-point weights of non-integer kernels
+  #define KERNEL_FRACTION_BITS 12
+
+  // A square convolution kernel of (2 * radius + 1) x (2 * radius + 1)
+  // integer weights. Each output sample is the weighted sum of the samples
+  // around it, plus bias, divided by divisor (or shifted right by shift
+  // when divisor is a power of two). Kernels whose weights are all integers
+  // are applied exactly, so a box kernel truncates as the blur does; others
+  // are rounded to KERNEL_FRACTION_BITS-bit fixed point.
+  struct convolution_kernel {
+    int radius;
+    // the weights factor into column[j] * row[i], so the kernel can be
+    // applied as two 1-D passes
+    bool separable;
+    // every weight is equal (the kernel is a box blur)
+    bool uniform;
+    // 2 * radius + 1 weights each (separable kernels only)
+    int32_t *row;
+    int32_t *column;
+    // all weights, row by row (non-separable kernels only)
+    int32_t *weights;
+    int64_t divisor;
+    int64_t bias;
+    // log2 of divisor, or -1 if it is not a power of two
+    int shift;
+  };
+
+  // initialise a kernel from size x size weights given row by row (weights
+  // are normalised by their sum unless it is zero)
+  bool init_kernel_from_weights(struct convolution_kernel *kernel,
+                                const double *weights, int size);
+
+  // initialise a kernel from a text file of whitespace-separated weights,
+  // row by row (an odd square number of them; lines starting with # are
+  // comments)
+  bool init_kernel_from_file(struct convolution_kernel *kernel,
+                             const char *path);
+
+  // initialise the (2 * radius + 1)-wide averaging kernel used by blur
+  bool init_box_kernel(struct convolution_kernel *kernel, int radius);
+
+  // initialise a Gaussian kernel of the given standard deviation (cut off
+  // at three standard deviations)
+  bool init_gaussian_kernel(struct convolution_kernel *kernel, double sigma);
+
+  // initialise the 3x3 sharpening kernel
+  bool init_sharpen_kernel(struct convolution_kernel *kernel);
+
+  // initialise a kernel from a preset name ("box:radius", "gaussian:sigma"
+  // or "sharpen") or else the path of a kernel file
+  bool init_kernel_from_spec(struct convolution_kernel *kernel,
+                             const char *spec);
+
+  // clean up the kernel's weights
+  void clear_kernel(struct convolution_kernel *kernel);
+
+#endif
@@ -0,0 +1,500 @@
+#include "Orientation.h"
+#include <pthread.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
+
+  // edge length of the blocks a rotation transposes at a time (a source 
+  // block and its destination stay within a core's L1 cache)
+  #define ROTATE_BLOCK_SIZE 64
+  // rows (or pairs of rows) an in-place flip hands out at a time
+  #define MIRROR_ROW_CHUNK 16
+  // bytes of two rows exchanged at a time by a vertical flip
+  #define ROW_SWAP_CHUNK 4096
+
+  // copy n pixels into a row from a source walk that starts at src and 
+  // moves step bytes between pixels
+  static void copy_pixel_walk(uint8_t *dst, const uint8_t *src, 
+                              ptrdiff_t step, int n, int bpp){
+    for(int i = 0; i < n; i++, dst += bpp, src += step){
+      memcpy(dst, src, bpp);
+    }
+  }
+
+  // transpose a width x height block of pixels, so row k of dst holds 
+  // column k of src (a negative stride walks either picture upwards)
+  static void transpose_pixels(const uint8_t *src, ptrdiff_t src_stride, 
+                               uint8_t *dst, ptrdiff_t dst_stride, 
+                               int width, int height, int bpp){
+    for(int k = 0; k < width; k++){
+      copy_pixel_walk(dst + k * dst_stride, src + (ptrdiff_t) k * bpp, 
+                      src_stride, height, bpp);
+    }
+  }
+
+#ifdef HAVE_X86_SIMD
+
+  // SSSE3 versions: whole 8x8 blocks of gray pixels, or 4x4 blocks of 
+  // colour pixels, in registers
+  __attribute__((target("ssse3")))
+  static void transpose_gray_8x8(const uint8_t *src, ptrdiff_t src_stride, 
+                                 uint8_t *dst, ptrdiff_t dst_stride){
+    __m128i rows[8];
+    for(int k = 0; k < 8; k++){
+      rows[k] = _mm_loadl_epi64((const __m128i *) (src + k * src_stride));
+    }
+    // interleave pairs of rows, then pairs of pairs, then quads
+    __m128i pairs[4], quads[4], columns[4];
+    for(int k = 0; k < 4; k++){
+      pairs[k] = _mm_unpacklo_epi8(rows[2 * k], rows[2 * k + 1]);
+    }
+    for(int k = 0; k < 2; k++){
+      quads[2 * k] = _mm_unpacklo_epi16(pairs[2 * k], pairs[2 * k + 1]);
+      quads[2 * k + 1] = _mm_unpackhi_epi16(pairs[2 * k], pairs[2 * k + 1]);
+    }
+    columns[0] = _mm_unpacklo_epi32(quads[0], quads[2]);
+    columns[1] = _mm_unpackhi_epi32(quads[0], quads[2]);
+    columns[2] = _mm_unpacklo_epi32(quads[1], quads[3]);
+    columns[3] = _mm_unpackhi_epi32(quads[1], quads[3]);
+    // each register now holds two columns of the block
+    for(int k = 0; k < 4; k++){
+      _mm_storel_epi64((__m128i *) (dst + 2 * k * dst_stride), columns[k]);
+      _mm_storel_epi64((__m128i *) (dst + (2 * k + 1) * dst_stride), 
+                       _mm_unpackhi_epi64(columns[k], columns[k]));
+    }
+  }
+
+  // transpose four rows of four 32-bit pixels
+  __attribute__((target("ssse3")))
+  static void transpose_4x4(__m128i rows[4]){
+    __m128i low[2], high[2];
+    for(int k = 0; k < 2; k++){
+      low[k] = _mm_unpacklo_epi32(rows[2 * k], rows[2 * k + 1]);
+      high[k] = _mm_unpackhi_epi32(rows[2 * k], rows[2 * k + 1]);
+    }
+    rows[0] = _mm_unpacklo_epi64(low[0], low[1]);
+    rows[1] = _mm_unpackhi_epi64(low[0], low[1]);
+    rows[2] = _mm_unpacklo_epi64(high[0], high[1]);
+    rows[3] = _mm_unpackhi_epi64(high[0], high[1]);
+  }
+
+  __attribute__((target("ssse3")))
+  static void transpose_rgbx_4x4(const uint8_t *src, ptrdiff_t src_stride, 
+                                 uint8_t *dst, ptrdiff_t dst_stride){
+    __m128i rows[4];
+    for(int k = 0; k < 4; k++){
+      rows[k] = _mm_loadu_si128((const __m128i *) (src + k * src_stride));
+    }
+    transpose_4x4(rows);
+    for(int k = 0; k < 4; k++){
+      _mm_storeu_si128((__m128i *) (dst + k * dst_stride), rows[k]);
+    }
+  }
+
+  // 3-byte pixels are spread out to 32 bits, transposed and packed again 
+  // (loading and storing exactly 12 bytes, so no neighbour is touched)
+  __attribute__((target("ssse3")))
+  static void transpose_rgb_4x4(const uint8_t *src, ptrdiff_t src_stride, 
+                                uint8_t *dst, ptrdiff_t dst_stride){
+    const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 
+                                         6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 
+                                       10, 12, 13, 14, -1, -1, -1, -1);
+    __m128i rows[4];
+    for(int k = 0; k < 4; k++){
+      const uint8_t *row = src + k * src_stride;
+      int32_t last;
+      memcpy(&last, row + 8, sizeof(last));
+      rows[k] = _mm_shuffle_epi8(
+                  _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *) row),
+                                     _mm_cvtsi32_si128(last)), 
+                  spread);
+    }
+    transpose_4x4(rows);
+    for(int k = 0; k < 4; k++){
+      uint8_t *row = dst + k * dst_stride;
+      __m128i packed = _mm_shuffle_epi8(rows[k], pack);
+      int32_t last = _mm_cvtsi128_si32(_mm_srli_si128(packed, 8));
+      _mm_storel_epi64((__m128i *) row, packed);
+      memcpy(row + 8, &last, sizeof(last));
+    }
+  }
+
+  __attribute__((target("ssse3")))
+  static void transpose_pixels_ssse3(const uint8_t *src, ptrdiff_t src_stride,
+                                     uint8_t *dst, ptrdiff_t dst_stride, 
+                                     int width, int height, int bpp){
+    int edge = bpp == PICTURE_GRAY_BPP ? 8 : 4;
+    int full_width = width - width % edge;
+    int full_height = height - height % edge;
+    for(int y = 0; y < full_height; y += edge){
+      for(int x = 0; x < full_width; x += edge){
+        const uint8_t *in = src + y * src_stride + (ptrdiff_t) x * bpp;
+        uint8_t *out = dst + x * dst_stride + (ptrdiff_t) y * bpp;
+        switch(bpp){
+          case(PICTURE_GRAY_BPP):
+            transpose_gray_8x8(in, src_stride, out, dst_stride);
+            break;
+          case(PICTURE_RGB_BPP):
+            transpose_rgb_4x4(in, src_stride, out, dst_stride);
+            break;
+          default:
+            transpose_rgbx_4x4(in, src_stride, out, dst_stride);
+            break;
+        }
+      }
+    }
+    // the ragged right and bottom edges of the block
+    transpose_pixels(src + (ptrdiff_t) full_width * bpp, src_stride, 
+                     dst + full_width * dst_stride, dst_stride, 
+                     width - full_width, full_height, bpp);
+    transpose_pixels(src + full_height * src_stride, src_stride, 
+                     dst + (ptrdiff_t) full_height * bpp, dst_stride, 
+                     width, height - full_height, bpp);
+  }
+
+#endif
+
+  // the fastest block transpose this CPU supports, chosen once via cpuid
+  static void (*block_transpose)(const uint8_t *, ptrdiff_t, uint8_t *, 
+                                 ptrdiff_t, int, int, int);
+  static pthread_once_t block_transpose_once = PTHREAD_ONCE_INIT;
+
+  static void select_block_transpose(void){
+    block_transpose = transpose_pixels;
+  #ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("ssse3")){
+      block_transpose = transpose_pixels_ssse3;
+    }
+  #endif
+  }
+
+  // A transpose of a whole picture, split into bands of ROTATE_BLOCK_SIZE 
+  // destination rows that workers take in turn
+  struct transpose_work_args {
+    const uint8_t *src;
+    ptrdiff_t src_stride;
+    uint8_t *dst;
+    ptrdiff_t dst_stride;
+    // destination size
+    int width;
+    int height;
+    int bpp;
+    atomic_int next;
+  };
+
+  // transpose bands of destination rows, one cache block at a time, until 
+  // none are left
+  static void *transpose_worker(void *args){
+    struct transpose_work_args *work = args;
+    int bpp = work->bpp;
+    for(int j = atomic_fetch_add(&work->next, ROTATE_BLOCK_SIZE); 
+        j < work->height; 
+        j = atomic_fetch_add(&work->next, ROTATE_BLOCK_SIZE)){
+      int rows = work->height - j < ROTATE_BLOCK_SIZE ? 
+                 work->height - j : ROTATE_BLOCK_SIZE;
+      for(int i = 0; i < work->width; i += ROTATE_BLOCK_SIZE){
+        int columns = work->width - i < ROTATE_BLOCK_SIZE ? 
+                      work->width - i : ROTATE_BLOCK_SIZE;
+        block_transpose(work->src + i * work->src_stride + (ptrdiff_t) j * bpp,
+                        work->src_stride, 
+                        work->dst + j * work->dst_stride + (ptrdiff_t) i * bpp,
+                        work->dst_stride, rows, columns, bpp);
+      }
+    }
+    return NULL;
+  }
+
+  // transpose the linear picture src into dst, taking the rows of src 
+  // and/or dst bottom to top (src upwards turns the transpose into a 
+  // 90-degree rotation, dst upwards into a 270-degree one, and both into 
+  // the transverse)
+  static void transpose_picture(struct picture *dst, struct picture *src, 
+                                bool src_upwards, bool dst_upwards){
+    pthread_once(&block_transpose_once, select_block_transpose);
+    struct transpose_work_args work = {
+      picture_row(src, 0), picture_stride(src), 
+      picture_row(dst, 0), picture_stride(dst), 
+      dst->width, dst->height, src->bpp, 0
+    };
+    if(src_upwards){
+      work.src = picture_row(src, src->height - 1);
+      work.src_stride = -work.src_stride;
+    }
+    if(dst_upwards){
+      work.dst = picture_row(dst, dst->height - 1);
+      work.dst_stride = -work.dst_stride;
+    }
+    int bands = (dst->height + ROTATE_BLOCK_SIZE - 1) / ROTATE_BLOCK_SIZE;
+    int threads = core_count();
+    run_workers(transpose_worker, &work, bands < threads ? bands : threads);
+  }
+
+  // exchange the pixels of row a with those of row b in reverse order, so 
+  // a[i] <-> b[n - 1 - i] (reversing the row in place if a is b)
+  static void swap_reversed(uint8_t *a, uint8_t *b, int n, int bpp){
+    int pairs = a == b ? n / 2 : n;
+    uint8_t pixel[PICTURE_RGBX_BPP];
+    for(int i = 0; i < pairs; i++){
+      uint8_t *left = a + (ptrdiff_t) i * bpp;
+      uint8_t *right = b + (ptrdiff_t) (n - 1 - i) * bpp;
+      memcpy(pixel, left, bpp);
+      memcpy(left, right, bpp);
+      memcpy(right, pixel, bpp);
+    }
+  }
+
+#ifdef HAVE_X86_SIMD
+
+  // SSSE3 version: a chunk from the left of a and one from the right of b 
+  // are both loaded, reversed with a byte shuffle and stored crosswise
+  // (16 gray or 4 RGBX pixels at a time, or 4 RGB pixels in exactly 12 
+  // bytes, so the chunks never touch each other or the pixels around them)
+  __attribute__((target("ssse3")))
+  static __m128i load_rgb_4(const uint8_t *pixels){
+    int32_t last;
+    memcpy(&last, pixels + 8, sizeof(last));
+    return _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *) pixels),
+                              _mm_cvtsi32_si128(last));
+  }
+
+  __attribute__((target("ssse3")))
+  static void store_rgb_4(uint8_t *pixels, __m128i packed){
+    int32_t last = _mm_cvtsi128_si32(_mm_srli_si128(packed, 8));
+    _mm_storel_epi64((__m128i *) pixels, packed);
+    memcpy(pixels + 8, &last, sizeof(last));
+  }
+
+  __attribute__((target("ssse3")))
+  static void swap_reversed_ssse3(uint8_t *a, uint8_t *b, int n, int bpp){
+    int pairs = a == b ? n / 2 : n;
+    int chunk = bpp == PICTURE_GRAY_BPP ? 16 : 4;
+    __m128i reverse;
+    switch(bpp){
+      case(PICTURE_GRAY_BPP):
+        reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 
+                                7, 6, 5, 4, 3, 2, 1, 0);
+        break;
+      case(PICTURE_RGB_BPP):
+        reverse = _mm_setr_epi8(9, 10, 11, 6, 7, 8, 3, 4, 
+                                5, 0, 1, 2, -1, -1, -1, -1);
+        break;
+      default:
+        reverse = _mm_setr_epi8(12, 13, 14, 15, 8, 9, 10, 11, 
+                                4, 5, 6, 7, 0, 1, 2, 3);
+        break;
+    }
+    int i = 0;
+    for(; i + chunk <= pairs; i += chunk){
+      uint8_t *left = a + (ptrdiff_t) i * bpp;
+      uint8_t *right = b + (ptrdiff_t) (n - i - chunk) * bpp;
+      if(bpp == PICTURE_RGB_BPP){
+        __m128i l = load_rgb_4(left);
+        __m128i r = load_rgb_4(right);
+        store_rgb_4(left, _mm_shuffle_epi8(r, reverse));
+        store_rgb_4(right, _mm_shuffle_epi8(l, reverse));
+      } else {
+        __m128i l = _mm_loadu_si128((const __m128i *) left);
+        __m128i r = _mm_loadu_si128((const __m128i *) right);
+        _mm_storeu_si128((__m128i *) left, _mm_shuffle_epi8(r, reverse));
+        _mm_storeu_si128((__m128i *) right, _mm_shuffle_epi8(l, reverse));
+      }
+    }
+    // the pixels left over in the middle
+    if(a == b){
+      swap_reversed(a + (ptrdiff_t) i * bpp, a + (ptrdiff_t) i * bpp, 
+                    n - 2 * i, bpp);
+    } else {
+      swap_reversed(a + (ptrdiff_t) i * bpp, b, n - i, bpp);
+    }
+  }
+
+#endif
+
+  // the fastest reversing swap this CPU supports, chosen once via cpuid
+  static void (*row_swap_reversed)(uint8_t *, uint8_t *, int, int);
+  static pthread_once_t row_swap_reversed_once = PTHREAD_ONCE_INIT;
+
+  static void select_row_swap_reversed(void){
+    row_swap_reversed = swap_reversed;
+  #ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("ssse3")){
+      row_swap_reversed = swap_reversed_ssse3;
+    }
+  #endif
+  }
+
+  // exchange n bytes of rows a and b
+  static void swap_rows(uint8_t *a, uint8_t *b, size_t n){
+    uint8_t chunk[ROW_SWAP_CHUNK];
+    for(size_t k = 0; k < n; k += ROW_SWAP_CHUNK){
+      size_t bytes = n - k < ROW_SWAP_CHUNK ? n - k : ROW_SWAP_CHUNK;
+      memcpy(chunk, a + k, bytes);
+      memcpy(a + k, b + k, bytes);
+      memcpy(b + k, chunk, bytes);
+    }
+  }
+
+  // An in-place flip or half turn of a whole linear picture: rows j, or 
+  // pairs of rows j and (height - 1 - j), that workers take in turn
+  struct mirror_work_args {
+    struct picture *pic;
+    // reverse the pixels of each row (a horizontal flip)
+    bool reverse_rows;
+    // exchange rows j and (height - 1 - j) (a vertical flip)
+    bool swap_rows;
+    atomic_int next;
+  };
+
+  static int mirror_rows(struct mirror_work_args *work){
+    return work->swap_rows ? (work->pic->height + 1) / 2 : work->pic->height;
+  }
+
+  // mirror rows until none are left
+  static void *mirror_worker(void *args){
+    struct mirror_work_args *work = args;
+    struct picture *pic = work->pic;
+    int rows = mirror_rows(work);
+    for(int j = atomic_fetch_add(&work->next, MIRROR_ROW_CHUNK); j < rows; 
+        j = atomic_fetch_add(&work->next, MIRROR_ROW_CHUNK)){
+      int end = j + MIRROR_ROW_CHUNK < rows ? j + MIRROR_ROW_CHUNK : rows;
+      for(int y = j; y < end; y++){
+        uint8_t *a = picture_row(pic, y);
+        uint8_t *b = work->swap_rows ? picture_row(pic, pic->height - 1 - y) 
+                                     : a;
+        if(work->reverse_rows){
+          row_swap_reversed(a, b, pic->width, pic->bpp);
+        } else if(a != b){
+          swap_rows(a, b, (size_t) pic->width * pic->bpp);
+        }
+      }
+    }
+    return NULL;
+  }
+
+  // flip the linear picture pic in place, horizontally, vertically or both
+  // (a half turn), with no second picture
+  static bool mirror_in_place(struct picture *pic, bool reverse_rows, 
+                              bool swap_rows){
+    if(!picture_make_writable(pic)){
+      return false;
+    }
+    pthread_once(&row_swap_reversed_once, select_row_swap_reversed);
+    struct mirror_work_args work = {pic, reverse_rows, swap_rows, 0};
+    int chunks = (mirror_rows(&work) + MIRROR_ROW_CHUNK - 1) / 
+                 MIRROR_ROW_CHUNK;
+    int threads = core_count();
+    run_workers(mirror_worker, &work, chunks < threads ? 
+                                      (chunks > 0 ? chunks : 1) : threads);
+    return true;
+  }
+
+  // Source coordinates of each output pixel (i,j) of a rotation or flip:
+  // (x0 + xi*i + xj*j, y0 + yi*i + yj*j)
+  struct pixel_map {
+    int x0, xi, xj;
+    int y0, yi, yj;
+  };
+
+  // fill dst from src through map, one destination tile at a time (the 
+  // source pixels of a tile lie in at most four source tiles, so every 
+  // walk stays cache-resident whatever its direction)
+  static void remap_tiled(struct picture *dst, struct picture *src, 
+                          struct pixel_map *map){
+    int bpp = src->bpp;
+    for(int ty = 0; ty < dst->height; ty += PICTURE_TILE_SIZE){
+      int tile_end_y = ty + PICTURE_TILE_SIZE < dst->height ? 
+                       ty + PICTURE_TILE_SIZE : dst->height;
+      for(int tx = 0; tx < dst->width; tx += PICTURE_TILE_SIZE){
+        int run = picture_run_length(dst, tx);
+        for(int j = ty; j < tile_end_y; j++){
+          uint8_t *out = picture_pixel(dst, tx, j);
+          int x = map->x0 + map->xi * tx + map->xj * j;
+          int y = map->y0 + map->yi * tx + map->yj * j;
+          for(int i = 0; i < run; i++, out += bpp){
+            memcpy(out, picture_pixel(src, x, y), bpp);
+            x += map->xi;
+            y += map->yi;
+          }
+        }
+      }
+    }
+  }
+
+  // where each pixel of a picture in the given orientation comes from in 
+  // the upright width x height picture it was turned from
+  static struct pixel_map orientation_map(int width, int height, 
+                                          enum picture_orientation orientation){
+    int w = width - 1;
+    int h = height - 1;
+    switch(orientation){
+      case(ORIENT_ROTATE_90):
+        return (struct pixel_map) {0, 0, 1, h, -1, 0};
+      case(ORIENT_ROTATE_180):
+        return (struct pixel_map) {w, -1, 0, h, 0, -1};
+      case(ORIENT_ROTATE_270):
+        return (struct pixel_map) {w, 0, -1, 0, 1, 0};
+      case(ORIENT_FLIP_H):
+        return (struct pixel_map) {w, -1, 0, 0, 0, 1};
+      case(ORIENT_TRANSVERSE):
+        return (struct pixel_map) {w, 0, -1, h, -1, 0};
+      case(ORIENT_FLIP_V):
+        return (struct pixel_map) {0, 1, 0, h, 0, -1};
+      case(ORIENT_TRANSPOSE):
+        return (struct pixel_map) {0, 0, 1, 0, 1, 0};
+      default:
+        return (struct pixel_map) {0, 1, 0, 0, 0, 1};
+    }
+  }
+
+  void orientation_source(enum picture_orientation orientation, int width, 
+                          int height, int *x, int *y){
+    struct pixel_map map = orientation_map(width, height, orientation);
+    int i = *x;
+    int j = *y;
+    *x = map.x0 + map.xi * i + map.xj * j;
+    *y = map.y0 + map.yi * i + map.yj * j;
+  }
+
+  bool reorient_pixels(struct picture *pic, 
+                       enum picture_orientation orientation){
+    if(orientation == ORIENT_UPRIGHT){
+      return true;
+    }
+
+    // flips and half turns of a linear picture just move pixels within it
+    bool swaps_axes = orientation_swaps_axes(orientation);
+    if(pic->layout == PICTURE_LINEAR && !swaps_axes){
+      return mirror_in_place(pic, 
+               orientation == ORIENT_FLIP_H || orientation == ORIENT_ROTATE_180,
+               orientation == ORIENT_FLIP_V || orientation == ORIENT_ROTATE_180);
+    }
+
+    // make new temporary picture to work in
+    struct picture tmp;
+    if(!init_picture_like(&tmp, pic, swaps_axes ? pic->height : pic->width,
+                          swaps_axes ? pic->width : pic->height)){
+      return false;
+    }
+
+    if(pic->layout == PICTURE_TILED){
+      struct pixel_map map = orientation_map(pic->width, pic->height, 
+                                             orientation);
+      remap_tiled(&tmp, pic, &map);
+    } else {
+      transpose_picture(&tmp, pic, 
+        orientation == ORIENT_ROTATE_90 || orientation == ORIENT_TRANSVERSE,
+        orientation == ORIENT_ROTATE_270 || orientation == ORIENT_TRANSVERSE);
+    }
+
+    // clean-up the old picture and replace with new picture
+    clear_picture(pic);
+    overwrite_picture(pic, &tmp);
+    return true;
+  }
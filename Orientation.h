@@ -0,0 +1,18 @@
+#ifndef ORIENTATION_H
+#define ORIENTATION_H
+
+#include "Picture.h"
+
+  // Move the stored pixels of the upright picture pic into the given 
+  // orientation in one pass, in place where its shape is kept and it is 
+  // linear, else through a second picture (quarter turns and diagonal 
+  // flips are blocked transposes, on one thread per core)
+  bool reorient_pixels(struct picture *pic, 
+                       enum picture_orientation orientation);
+
+  // map pixel (*x, *y) of a picture in the given orientation to where it 
+  // is stored in the upright width x height picture it was turned from
+  void orientation_source(enum picture_orientation orientation, int width, 
+                          int height, int *x, int *y);
+
+#endif
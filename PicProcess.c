@@ -1,167 +1,720 @@
 #include "PicProcess.h"
 #include <pthread.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
 #include <time.h>
+#include <stdatomic.h>
+#include <limits.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
 
   #define NO_RGB_COMPONENTS 3
   #define BLUR_REGION_SIZE 9
-  #define PTHREAD_CREATE_FAIL_CODE 1
   #define PTHREAD_CREATE_SUCCESS_CODE 0
   #define BOUNDARY_WIDTH 1
+  // (sum * BLUR_RECIPROCAL) >> 16 == sum / BLUR_REGION_SIZE for every sum
+  // of nine 8-bit samples
+  #define BLUR_RECIPROCAL 7282
+  // edge length of the tiles a fused blur works through, and the most 
+  // passes it makes over a tile before writing the picture back (larger 
+  // runs are split, as the halo around each tile grows with the passes)
+  #define FUSED_BLUR_TILE_SIZE 128
+  #define FUSED_BLUR_MAX_PASSES 16
+  // edge length of the tiles a parallel blur hands out (a tile, its halo 
+  // and its output stay well within a core's L2 cache)
+  #define BLUR_TILE_SIZE 128
+  // fractional bits of the fixed-point source coordinates a warp steps 
+  // through, and the output rows it hands out at a time
+  #define WARP_FRACTION_BITS 16
+  #define WARP_ROW_CHUNK 16
+  // bits of the fractional distances bilinear sampling blends by
+  #define BILINEAR_WEIGHT_BITS 7
+  #define BILINEAR_WEIGHT (1 << BILINEAR_WEIGHT_BITS)
+  // rows a point pipeline hands out at a time
+  #define POINT_ROW_CHUNK 64
+  // length of the repeating byte masks of an XOR pass (a multiple of 16 
+  // and of every bpp)
+  #define POINT_XOR_PERIOD 48
 
 
-  void invert_picture(struct picture *pic){
-    // iterate over each pixel in the picture
-    for(int i = 0 ; i < pic->width; i++){
-      for(int j = 0 ; j < pic->height; j++){
-        struct pixel rgb = get_pixel(pic, i, j);
-        
-        // invert RGB values of pixel
-        rgb.red = MAX_PIXEL_INTENSITY - rgb.red;
-        rgb.green = MAX_PIXEL_INTENSITY - rgb.green;
-        rgb.blue = MAX_PIXEL_INTENSITY - rgb.blue;
-        
-        // set pixel to inverted RBG values
-        set_pixel(pic, i, j, &rgb);
+  // abandon a transformation that has run out of memory, before any 
+  // part-written result can take the place of the picture
+  static void out_of_memory(void){
+    printf("[!] out of memory transforming picture\n    aborting...\n");
+    exit(MEMORY_ERROR);
+  }
+
+  // make tmp a new picture of the given size and format for a 
+  // transformation to write its result into, with dst a view of all of it
+  // (aborting if there is no memory for it)
+  static void init_result(struct picture *tmp, struct picture_view *dst, 
+                          int width, int height, int bpp){
+    if(!init_picture_for_overwrite(tmp, width, height, bpp) || 
+       !init_full_view(dst, tmp)){
+      out_of_memory();
+    }
+  }
+
+  // The form a point pipeline takes for a given picture
+  enum point_pass {
+    // every sample XORed with a fixed byte (vectorised)
+    POINT_XOR,
+    // a table for the one sample of gray pixels
+    POINT_GRAY,
+    // a table for each colour sample
+    POINT_TABLES,
+    // channels mixed through the sum tables, into colour or gray pixels
+    POINT_MIX
+  };
+
+  // A point pipeline applied to the rows of src, written to dst (the same 
+  // region, unless mixing to gray pixels), in chunks workers take in turn
+  struct point_work_args {
+    struct picture_view *src;
+    struct picture_view *dst;
+    const struct point_pipeline *pipeline;
+    enum point_pass pass;
+    // the table of POINT_GRAY
+    uint8_t table[256];
+    // the bytes each byte of a row is XORed with (repeating every 
+    // POINT_XOR_PERIOD bytes, a whole number of pixels at any bpp)
+    uint8_t masks[POINT_XOR_PERIOD];
+    atomic_int next;
+  };
+
+  // XOR n bytes of a row with the repeating masks
+  static void xor_row(uint8_t *row, size_t n, const uint8_t *masks){
+    size_t k = 0;
+  #ifdef __SSE2__
+    __m128i mask[POINT_XOR_PERIOD / 16];
+    for(int m = 0; m < POINT_XOR_PERIOD / 16; m++){
+      mask[m] = _mm_loadu_si128((const __m128i *) (masks + 16 * m));
+    }
+    for(; k + POINT_XOR_PERIOD <= n; k += POINT_XOR_PERIOD){
+      for(int m = 0; m < POINT_XOR_PERIOD / 16; m++){
+        __m128i *bytes = (__m128i *) (row + k + 16 * m);
+        _mm_storeu_si128(bytes, _mm_xor_si128(_mm_loadu_si128(bytes), 
+                                              mask[m]));
       }
-    }   
+    }
+  #endif
+    for(; k < n; k++){
+      row[k] ^= masks[k % POINT_XOR_PERIOD];
+    }
   }
 
-  void grayscale_picture(struct picture *pic){
-    // iterate over each pixel in the picture
-    for(int i = 0 ; i < pic->width; i++){
-      for(int j = 0 ; j < pic->height; j++){
-        struct pixel rgb = get_pixel(pic, i, j);
-        
-        // compute gray average of pixel's RGB values
-        int avg = (rgb.red + rgb.green + rgb.blue) / NO_RGB_COMPONENTS;
-        rgb.red = avg;
-        rgb.green = avg;
-        rgb.blue = avg;
-        
-        // set pixel to gray-scale RBG value
-        set_pixel(pic, i, j, &rgb);
+  // apply the pipeline to n pixels of a row of src into dst
+  static void point_row(struct point_work_args *work, const uint8_t *in, 
+                        uint8_t *out, int n){
+    const struct point_pipeline *pipeline = work->pipeline;
+    int bpp = work->src->parent->bpp;
+    switch(work->pass){
+      case(POINT_XOR):
+        xor_row(out, (size_t) n * bpp, work->masks);
+        break;
+      case(POINT_GRAY):
+        for(int i = 0; i < n; i++){
+          out[i] = work->table[in[i]];
+        }
+        break;
+      case(POINT_TABLES):
+        for(int i = 0; i < n; i++, in += bpp, out += bpp){
+          for(int c = 0; c < NO_RGB_COMPONENTS; c++){
+            out[c] = pipeline->channel[c][in[c]];
+          }
+        }
+        break;
+      default: {
+        int out_bpp = work->dst->parent->bpp;
+        int channels = picture_channels(work->dst->parent);
+        for(int i = 0; i < n; i++, in += bpp, out += out_bpp){
+          int sum = pipeline->channel[0][in[0]] + pipeline->channel[1][in[1]]
+                  + pipeline->channel[2][in[2]];
+          for(int c = 0; c < channels; c++){
+            out[c] = pipeline->sum[c][sum];
+          }
+        }
+        break;
       }
-    }    
+    }
   }
 
-  void rotate_picture(struct picture *pic, int angle){
-    // capture current picture size
-    int new_width = pic->width;
-    int new_height = pic->height;
-  
-    // adjust output picture size as necessary
-    if(angle == 90 || angle == 270){
-      new_width = pic->height;
-      new_height = pic->width;
+  // apply the pipeline to chunks of rows until none are left
+  static void *point_worker(void *args){
+    struct point_work_args *work = args;
+    int height = work->src->height;
+    for(int j = atomic_fetch_add(&work->next, POINT_ROW_CHUNK); j < height; 
+        j = atomic_fetch_add(&work->next, POINT_ROW_CHUNK)){
+      int end = j + POINT_ROW_CHUNK < height ? j + POINT_ROW_CHUNK : height;
+      for(int y = j; y < end; y++){
+        point_row(work, view_row(work->src, y), view_row(work->dst, y), 
+                  work->src->width);
+      }
     }
-    
-    // make new temporary picture to work in
-    struct picture tmp;
-    init_picture_from_size(&tmp, new_width, new_height);     
-  
-    // iterate over each pixel in the picture
-    for(int i = 0 ; i < new_width; i++){
-      for(int j = 0 ; j < new_height; j++){
-        struct pixel rgb;
-        // determine rotation angle and execute corresponding pixel update
-        switch(angle){
-          case(90):
-            rgb = get_pixel(pic, j, new_width -1 - i); 
-            break;
-          case(180):
-            rgb = get_pixel(pic, new_width - 1 - i, new_height - 1 - j);
-            break;
-          case(270):
-            rgb = get_pixel(pic, new_height - 1 - j, i);
-            break;
-          default:
-            printf("[!] rotate is undefined for angle %i (must be 90, 180 or 270)\n", angle);
-            clear_picture(&tmp);
-            clear_picture(pic);
-            exit(IO_ERROR);
+    return NULL;
+  }
+
+  // choose how to apply the pipeline to the pixels of a picture with bpp 
+  // bytes per pixel, returning false if they need colour storage first
+  static bool plan_point_pass(struct point_work_args *work, int bpp){
+    const struct point_pipeline *pipeline = work->pipeline;
+    uint8_t results[NO_RGB_COMPONENTS][256];
+    for(int c = 0; c < NO_RGB_COMPONENTS; c++){
+      for(int v = 0; v < 256; v++){
+        // what each channel of a gray pixel v becomes
+        int sum = pipeline->channel[0][v] + pipeline->channel[1][v] + 
+                  pipeline->channel[2][v];
+        results[c][v] = pipeline->mixed ? pipeline->sum[c][sum] 
+                                        : pipeline->channel[c][v];
+      }
+    }
+
+    if(bpp == PICTURE_GRAY_BPP){
+      // a gray pixel stays gray if its channels all map alike
+      if(memcmp(results[0], results[1], 256) || 
+         memcmp(results[0], results[2], 256)){
+        return false;
+      }
+      memcpy(work->table, results[0], 256);
+      work->pass = POINT_GRAY;
+    } else {
+      work->pass = pipeline->mixed ? POINT_MIX : POINT_TABLES;
+    }
+
+    // tables that only flip bits reduce to a vectorised XOR
+    if(work->pass != POINT_MIX){
+      int channels = bpp == PICTURE_GRAY_BPP ? 1 : NO_RGB_COMPONENTS;
+      for(int c = 0; c < channels; c++){
+        const uint8_t *table = bpp == PICTURE_GRAY_BPP ? work->table 
+                                                       : pipeline->channel[c];
+        for(int v = 0; v < 256; v++){
+          if((table[v] ^ v) != (table[0] ^ 0)){
+            return true;
+          }
         }
-        set_pixel(&tmp, i,j, &rgb);
       }
+      for(int k = 0; k < POINT_XOR_PERIOD; k++){
+        int c = k % bpp;
+        const uint8_t *table = bpp == PICTURE_GRAY_BPP ? work->table 
+                                                       : pipeline->channel[c];
+        // padding samples are left alone
+        work->masks[k] = c < channels ? table[0] : 0;
+      }
+      work->pass = POINT_XOR;
     }
-    
+    return true;
+  }
+
+  // whether a planned pass leaves every pixel as it was
+  static bool point_pass_is_identity(struct point_work_args *work){
+    if(work->pass != POINT_XOR){
+      return false;
+    }
+    for(int k = 0; k < POINT_XOR_PERIOD; k++){
+      if(work->masks[k] != 0){
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // apply a planned pass on one thread per core
+  static void run_point_pass(struct point_work_args *work){
+    atomic_init(&work->next, 0);
+    int chunks = (work->src->height + POINT_ROW_CHUNK - 1) / POINT_ROW_CHUNK;
+    int threads = core_count();
+    run_workers(point_worker, work, chunks < threads ? 
+                                    (chunks > 0 ? chunks : 1) : threads);
+  }
+
+  void point_ops_picture(struct picture *pic, 
+                         const struct point_pipeline *pipeline){
+    struct picture_view view;
+    if(!init_full_view(&view, pic)){
+      out_of_memory();
+    }
+    struct point_work_args work = {.src = &view, .dst = &view, 
+                                   .pipeline = pipeline};
+    if(!plan_point_pass(&work, pic->bpp)){
+      if(!picture_make_colour(pic) || !init_full_view(&view, pic)){
+        out_of_memory();
+      }
+      plan_point_pass(&work, pic->bpp);
+    }
+    if(point_pass_is_identity(&work)){
+      return;
+    }
+
+    // mixing colour to gray leaves only one sample per pixel to store
+    if(work.pass == POINT_MIX && point_pipeline_is_gray(pipeline)){
+      struct picture tmp;
+      struct picture_view dst;
+      init_result(&tmp, &dst, pic->width, pic->height, PICTURE_GRAY_BPP);
+      work.dst = &dst;
+      run_point_pass(&work);
+
+      // clean-up the old picture and replace with new picture
+      clear_picture(pic);
+      overwrite_picture(pic, &tmp);
+      return;
+    }
+
+    if(!view_make_writable(&view)){
+      out_of_memory();
+    }
+    run_point_pass(&work);
+  }
+
+  void point_ops_view(struct picture_view *view, 
+                      const struct point_pipeline *pipeline){
+    struct point_work_args work = {.src = view, .dst = view, 
+                                   .pipeline = pipeline};
+    if(!plan_point_pass(&work, view->parent->bpp)){
+      // views of a gray picture that gains colour follow it into colour 
+      // storage
+      if(!picture_make_colour(view->parent) || 
+         !init_picture_view(view, view->parent, view->x, view->y, 
+                            view->width, view->height)){
+        out_of_memory();
+      }
+      plan_point_pass(&work, view->parent->bpp);
+    }
+    if(point_pass_is_identity(&work)){
+      return;
+    }
+    if(!view_make_writable(view)){
+      out_of_memory();
+    }
+    run_point_pass(&work);
+  }
+
+  // a pipeline of the single operation add makes
+  static void single_point_op(struct point_pipeline *pipeline, 
+                              void (*add)(struct point_pipeline *)){
+    init_point_pipeline(pipeline);
+    add(pipeline);
+  }
+
+  void invert_picture(struct picture *pic){
+    struct point_pipeline pipeline;
+    single_point_op(&pipeline, add_point_invert);
+    point_ops_picture(pic, &pipeline);
+  }
+
+  void invert_view(struct picture_view *view){
+    struct point_pipeline pipeline;
+    single_point_op(&pipeline, add_point_invert);
+    point_ops_view(view, &pipeline);
+  }
+
+  void grayscale_picture(struct picture *pic){
+    struct point_pipeline pipeline;
+    single_point_op(&pipeline, add_point_grayscale);
+    point_ops_picture(pic, &pipeline);
+  }
+
+  void grayscale_view(struct picture_view *view){
+    // a region of a colour picture stays in colour storage
+    struct point_pipeline pipeline;
+    single_point_op(&pipeline, add_point_grayscale);
+    point_ops_view(view, &pipeline);
+  }
+
+  void rotate_picture(struct picture *pic, int angle){
+    if(angle != 90 && angle != 180 && angle != 270){
+      printf("[!] rotate is undefined for angle %i (must be 90, 180 or 270)\n", angle);
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+
+    // the pixels only move once something needs them
+    picture_orient(pic, angle / 90);
+  }
+
+  void flip_picture(struct picture *pic, char plane){
+    if(plane != 'V' && plane != 'H'){
+      printf("[!] flip is undefined for plane %c\n", plane);
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+
+    // the pixels only move once something needs them
+    picture_orient(pic, plane == 'H' ? ORIENT_FLIP_H : ORIENT_FLIP_V);
+  }
+
+  // An affine warp of the pixels of src into dst, in chunks of output rows
+  // that workers take in turn
+  struct warp_work_args {
+    struct picture_view *src;
+    struct picture_view *dst;
+    // where each output pixel comes from in src
+    struct affine_transform inverse;
+    enum sample_mode sampling;
+    atomic_int next;
+  };
+
+  static int64_t floor_div(int64_t a, int64_t b){
+    int64_t q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+  }
+
+  // narrow [*first, *last] to the steps i for which start + i * step lies 
+  // within [0, limit]
+  static void clip_steps(int64_t start, int64_t step, int64_t limit, 
+                         int64_t *first, int64_t *last){
+    if(step == 0){
+      if(start < 0 || start > limit){
+        *last = *first - 1;
+      }
+      return;
+    }
+    int64_t low = step > 0 ? -floor_div(start, step) 
+                           : -floor_div(limit - start, -step);
+    int64_t high = step > 0 ? floor_div(limit - start, step) 
+                            : floor_div(start, -step);
+    if(low > *first) *first = low;
+    if(high < *last) *last = high;
+  }
+
+  // blend n bilinear samples of src into out, from source coordinate 
+  // (u, v) in steps of (du, dv): across each pair of rows by the 
+  // fractional distance fx, then between the rows by fy (the far 
+  // neighbours of the last column and row have no weight)
+  static void bilinear_span(struct picture_view *src, uint8_t *out, int n, 
+                            int64_t u, int64_t v, int64_t du, int64_t dv){
+    const uint8_t *pixels = src->pixels;
+    size_t stride = src->stride;
+    int bpp = src->parent->bpp;
+    const int shift = WARP_FRACTION_BITS - BILINEAR_WEIGHT_BITS;
+    for(int i = 0; i < n; i++, u += du, v += dv, out += bpp){
+      int x = u >> WARP_FRACTION_BITS;
+      int y = v >> WARP_FRACTION_BITS;
+      int fx = (u >> shift) & (BILINEAR_WEIGHT - 1);
+      int fy = (v >> shift) & (BILINEAR_WEIGHT - 1);
+      const uint8_t *p00 = pixels + y * stride + (size_t) x * bpp;
+      const uint8_t *p01 = x < src->width - 1 ? p00 + bpp : p00;
+      const uint8_t *p10 = y < src->height - 1 ? p00 + stride : p00;
+      const uint8_t *p11 = x < src->width - 1 ? p10 + bpp : p10;
+      for(int c = 0; c < bpp; c++){
+        int top = p00[c] * (BILINEAR_WEIGHT - fx) + p01[c] * fx;
+        int bottom = p10[c] * (BILINEAR_WEIGHT - fx) + p11[c] * fx;
+        out[c] = (top * (BILINEAR_WEIGHT - fy) + bottom * fy + 
+                  (1 << (2 * BILINEAR_WEIGHT_BITS - 1))) >> 
+                 (2 * BILINEAR_WEIGHT_BITS);
+      }
+    }
+  }
+
+#ifdef HAVE_X86_SIMD
+
+  // SSSE3 version of bilinear_span for colour pixels whose neighbours all 
+  // lie within src, and at least 8 bytes from the end of their rows: the 
+  // two pixels of each row are read at once, their samples paired up and 
+  // widened by a shuffle, then blended by multiply-adds (bit-exact with 
+  // the above). Only colour bilinear sampling is vectorised: a gray pixel 
+  // has a single sample, so there are no channels to blend side by side,
+  // and nearest sampling is a copy per pixel from scattered addresses, 
+  // which SSSE3 has no gather to speed up; both stay scalar.
+  __attribute__((target("ssse3")))
+  static void bilinear_span_ssse3(struct picture_view *src, uint8_t *out, 
+                                  int n, int64_t u, int64_t v, int64_t du, 
+                                  int64_t dv){
+    const uint8_t *pixels = src->pixels;
+    size_t stride = src->stride;
+    int bpp = src->parent->bpp;
+    const int shift = WARP_FRACTION_BITS - BILINEAR_WEIGHT_BITS;
+    const __m128i top_pairs = bpp == PICTURE_RGB_BPP ?
+      _mm_setr_epi8(0, -1, 3, -1, 1, -1, 4, -1, 2, -1, 5, -1, -1, -1, -1, -1) :
+      _mm_setr_epi8(0, -1, 4, -1, 1, -1, 5, -1, 2, -1, 6, -1, 3, -1, 7, -1);
+    const __m128i bottom_pairs = bpp == PICTURE_RGB_BPP ?
+      _mm_setr_epi8(8, -1, 11, -1, 9, -1, 12, -1, 10, -1, 13, -1, -1, -1, -1, 
+                    -1) :
+      _mm_setr_epi8(8, -1, 12, -1, 9, -1, 13, -1, 10, -1, 14, -1, 11, -1, 15, 
+                    -1);
+    const __m128i round = _mm_set1_epi32(1 << (2 * BILINEAR_WEIGHT_BITS - 1));
+    for(int i = 0; i < n; i++, u += du, v += dv, out += bpp){
+      int x = u >> WARP_FRACTION_BITS;
+      int y = v >> WARP_FRACTION_BITS;
+      int fx = (u >> shift) & (BILINEAR_WEIGHT - 1);
+      int fy = (v >> shift) & (BILINEAR_WEIGHT - 1);
+      const uint8_t *p = pixels + y * stride + (size_t) x * bpp;
+      __m128i rows = _mm_unpacklo_epi64(
+        _mm_loadl_epi64((const __m128i *) p), 
+        _mm_loadl_epi64((const __m128i *) (p + stride)));
+      // each row's samples blended across, then the rows blended down
+      __m128i across = _mm_set1_epi32((fx << 16) | (BILINEAR_WEIGHT - fx));
+      __m128i top = _mm_madd_epi16(_mm_shuffle_epi8(rows, top_pairs), 
+                                   across);
+      __m128i bottom = _mm_madd_epi16(_mm_shuffle_epi8(rows, bottom_pairs), 
+                                      across);
+      __m128i down = _mm_madd_epi16(_mm_unpacklo_epi16(
+                       _mm_packs_epi32(top, top), 
+                       _mm_packs_epi32(bottom, bottom)), 
+                       _mm_set1_epi32((fy << 16) | (BILINEAR_WEIGHT - fy)));
+      down = _mm_srai_epi32(_mm_add_epi32(down, round), 
+                            2 * BILINEAR_WEIGHT_BITS);
+      down = _mm_packs_epi32(down, down);
+      int32_t samples = _mm_cvtsi128_si32(_mm_packus_epi16(down, down));
+      memcpy(out, &samples, bpp);
+    }
+  }
+
+#endif
+
+  // the fastest span of interior bilinear samples this CPU supports (for 
+  // colour pixels), chosen once via cpuid
+  static void (*interior_bilinear_span)(struct picture_view *, uint8_t *, 
+                                        int, int64_t, int64_t, int64_t, 
+                                        int64_t);
+  static pthread_once_t interior_bilinear_span_once = PTHREAD_ONCE_INIT;
+
+  static void select_interior_bilinear_span(void){
+    interior_bilinear_span = bilinear_span;
+  #ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("ssse3")){
+      interior_bilinear_span = bilinear_span_ssse3;
+    }
+  #endif
+  }
+
+  // warp one output row, stepping through the source in fixed point 
+  // (pixels that come from outside the source are left black)
+  static void warp_row(struct warp_work_args *work, int j){
+    struct picture_view *src = work->src;
+    const struct affine_transform *inverse = &work->inverse;
+    int bpp = src->parent->bpp;
+    int width = work->dst->width;
+    uint8_t *out = view_row(work->dst, j);
+
+    // source coordinates of the row's first pixel and their step along it
+    const double one = 1 << WARP_FRACTION_BITS;
+    int64_t u = llround((inverse->xy * j + inverse->x0) * one);
+    int64_t v = llround((inverse->yy * j + inverse->y0) * one);
+    int64_t du = llround(inverse->xx * one);
+    int64_t dv = llround(inverse->yx * one);
+
+    // the run of the row whose source pixels all lie within src
+    int64_t first = 0, last = width - 1;
+    clip_steps(u, du, (int64_t) (src->width - 1) << WARP_FRACTION_BITS, 
+               &first, &last);
+    clip_steps(v, dv, (int64_t) (src->height - 1) << WARP_FRACTION_BITS, 
+               &first, &last);
+    if(first > last){
+      memset(out, 0, (size_t) width * bpp);
+      return;
+    }
+    memset(out, 0, (size_t) first * bpp);
+    memset(out + (last + 1) * bpp, 0, (size_t) (width - 1 - last) * bpp);
+
+    if(work->sampling == SAMPLE_NEAREST){
+      const int64_t half = 1 << (WARP_FRACTION_BITS - 1);
+      u += first * du + half;
+      v += first * dv + half;
+      for(int64_t i = first; i <= last; i++, u += du, v += dv){
+        size_t x = u >> WARP_FRACTION_BITS;
+        size_t y = v >> WARP_FRACTION_BITS;
+        memcpy(out + i * bpp, src->pixels + y * src->stride + x * bpp, bpp);
+      }
+      return;
+    }
+    if(bpp == PICTURE_GRAY_BPP){
+      bilinear_span(src, out + first * bpp, last - first + 1, 
+                    u + first * du, v + first * dv, du, dv);
+      return;
+    }
+
+    // the interior of the run: pixels whose right and lower neighbours are
+    // in src, and which are at least 8 bytes from the end of their row
+    int64_t inner_first = first, inner_last = last;
+    int columns = src->width - (8 + bpp - 1) / bpp;
+    clip_steps(u, du, ((int64_t) columns << WARP_FRACTION_BITS) + 
+               (1 << WARP_FRACTION_BITS) - 1, &inner_first, &inner_last);
+    clip_steps(v, dv, ((int64_t) (src->height - 2) << WARP_FRACTION_BITS) +
+               (1 << WARP_FRACTION_BITS) - 1, &inner_first, &inner_last);
+    if(inner_first > inner_last){
+      // no interior: the whole run is sampled with edge checks
+      inner_first = last + 1;
+      inner_last = last;
+    }
+    bilinear_span(src, out + first * bpp, inner_first - first, 
+                  u + first * du, v + first * dv, du, dv);
+    interior_bilinear_span(src, out + inner_first * bpp, 
+                           inner_last - inner_first + 1, 
+                           u + inner_first * du, v + inner_first * dv, du, dv);
+    bilinear_span(src, out + (inner_last + 1) * bpp, last - inner_last, 
+                  u + (inner_last + 1) * du, v + (inner_last + 1) * dv, 
+                  du, dv);
+  }
+
+  // warp chunks of output rows until none are left
+  static void *warp_worker(void *args){
+    struct warp_work_args *work = args;
+    int height = work->dst->height;
+    for(int j = atomic_fetch_add(&work->next, WARP_ROW_CHUNK); j < height; 
+        j = atomic_fetch_add(&work->next, WARP_ROW_CHUNK)){
+      int end = j + WARP_ROW_CHUNK < height ? j + WARP_ROW_CHUNK : height;
+      for(int y = j; y < end; y++){
+        warp_row(work, y);
+      }
+    }
+    return NULL;
+  }
+
+  void warp_picture(struct picture *pic, 
+                    const struct affine_transform *transform, 
+                    enum sample_mode sampling){
+    double det = transform->xx * transform->yy - 
+                 transform->xy * transform->yx;
+    if(det == 0 || !isfinite(det) || !isfinite(transform->x0) || 
+       !isfinite(transform->y0)){
+      printf("[!] warp is undefined for a transform with no inverse\n");
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+
+    struct picture_view src;
+    if(!init_full_view(&src, pic)){
+      out_of_memory();
+    }
+
+    // make new temporary picture to work in
+    struct picture tmp;
+    struct picture_view dst;
+    init_result(&tmp, &dst, pic->width, pic->height, pic->bpp);
+
+    // each output pixel is sampled where the inverse transform takes it
+    struct warp_work_args work = {&src, &dst, {
+      transform->yy / det, -transform->xy / det, 
+      (transform->xy * transform->y0 - transform->yy * transform->x0) / det,
+      -transform->yx / det, transform->xx / det, 
+      (transform->yx * transform->x0 - transform->xx * transform->y0) / det
+    }, sampling, 0};
+    pthread_once(&interior_bilinear_span_once, select_interior_bilinear_span);
+    int chunks = (dst.height + WARP_ROW_CHUNK - 1) / WARP_ROW_CHUNK;
+    int threads = core_count();
+    run_workers(warp_worker, &work, chunks < threads ? 
+                                    (chunks > 0 ? chunks : 1) : threads);
+
     // clean-up the old picture and replace with new picture
     clear_picture(pic);
     overwrite_picture(pic, &tmp);
   }
 
-  void flip_picture(struct picture *pic, char plane){
+  void rotate_picture_by(struct picture *pic, double degrees, 
+                         enum sample_mode sampling){
+    if(!isfinite(degrees)){
+      printf("[!] rotate is undefined for angle %g\n", degrees);
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+
+    // whole quarter turns map the pixel grid onto itself, so they only 
+    // reorient the picture (swapping its width and height if need be)
+    double turns = fmod(degrees, 360) / 90;
+    if(turns < 0){
+      turns += 4;
+    }
+    if(turns == rint(turns)){
+      picture_orient(pic, (int) turns % 4);
+      return;
+    }
+
+    // clockwise on screen (y points down) about the picture's centre
+    double radians = degrees * M_PI / 180;
+    double c = cos(radians);
+    double s = sin(radians);
+    double cx = (pic->width - 1) / 2.0;
+    double cy = (pic->height - 1) / 2.0;
+    struct affine_transform rotation = {
+      c, -s, cx - c * cx + s * cy,
+      s, c, cy - s * cx - c * cy
+    };
+    warp_picture(pic, &rotation, sampling);
+  }
+
+  // blur the whole of pic with a kernel that blurs one view into another 
+  // over the given radius (and returns false if it ran out of memory)
+  static void blur_picture_with(struct picture *pic, 
+            bool (*kernel)(struct picture_view *, struct picture_view *, int),
+            int radius){
+    struct picture_view src;
+    if(!init_full_view(&src, pic)){
+      out_of_memory();
+    }
+
     // make new temporary picture to work in
     struct picture tmp;
-    init_picture_from_size(&tmp, pic->width, pic->height);
-    
-    // iterate over each pixel in the picture
-    for(int i = 0 ; i < tmp.width; i++){
-      for(int j = 0 ; j < tmp.height; j++){    
-        struct pixel rgb;
-        // determine flip plane and execute corresponding pixel update
-        switch(plane){
-          case('V'):
-            rgb = get_pixel(pic, i, tmp.height - 1 - j);
-            break;
-          case('H'):
-            rgb = get_pixel(pic, tmp.width - 1 - i, j);
-            break;
-          default:
-            printf("[!] flip is undefined for plane %c\n", plane);
-            clear_picture(&tmp);
-            clear_picture(pic);
-            exit(IO_ERROR);
-        } 
-        set_pixel(&tmp, i, j, &rgb);
-      }
+    struct picture_view dst;
+    init_result(&tmp, &dst, pic->width, pic->height, pic->bpp);
+    if(!kernel(&src, &dst, radius)){
+      clear_picture(&tmp);
+      out_of_memory();
     }
-
+    
     // clean-up the old picture and replace with new picture
     clear_picture(pic);
     overwrite_picture(pic, &tmp);
   }
 
-  void blur_picture(struct picture *pic){
+  // blur the region of view in place with a kernel as above
+  static void blur_view_with(struct picture_view *view, 
+            bool (*kernel)(struct picture_view *, struct picture_view *, int),
+            int radius){
+    // make new temporary region-sized picture to work in
+    struct picture tmp;
+    struct picture_view dst;
+    init_result(&tmp, &dst, view->width, view->height, view->parent->bpp);
+    if(!kernel(view, &dst, radius) || !view_make_writable(view)){
+      clear_picture(&tmp);
+      out_of_memory();
+    }
+
+    // write the blurred region back into the parent picture
+    for(int j = 0; j < view->height; j++){
+      memcpy(view_row(view, j), picture_row(&tmp, j), 
+             (size_t) view->width * tmp.bpp);
+    }
+    clear_picture(&tmp);
+  }
+
+  // the fixed-radius kernels in the form blur_picture_with expects
+  static bool box_kernel(struct picture_view *src, struct picture_view *dst, 
+                         int unused){
+    return box_blur_view_into(src, dst);
+  }
+
+  static bool simd_kernel(struct picture_view *src, struct picture_view *dst,
+                          int unused){
+    return simd_blur_view_into(src, dst);
+  }
+
+  void convolve_picture(struct picture *pic, 
+                        const struct convolution_kernel *kernel,
+                        enum border_mode border){
+    // the 3x3 box blur needs no second picture (unless its border pixels 
+    // read the original values of pixels it has already blurred)
+    if(kernel->uniform && kernel->radius == BOUNDARY_WIDTH && 
+       border == BORDER_COPY){
+      inplace_blur_picture(pic);
+      return;
+    }
+
+    struct picture_view src;
+    if(!init_full_view(&src, pic)){
+      out_of_memory();
+    }
+
     // make new temporary picture to work in
     struct picture tmp;
-    init_picture_from_size(&tmp, pic->width, pic->height);
-  
-    // iterate over each pixel in the picture
-    for(int i = 0 ; i < tmp.width; i++){
-      for(int j = 0 ; j < tmp.height; j++){
-      
-        // set-up a local pixel on the stack
-        struct pixel rgb = get_pixel(pic, i, j);
-        
-        // don't need to modify boundary pixels
-        if(i != 0 && j != 0 && i != tmp.width - 1 && j != tmp.height - 1){
-        
-          // set up running RGB component totals for pixel region
-          int sum_red = rgb.red;
-          int sum_green = rgb.green;
-          int sum_blue = rgb.blue;
-      
-          // check the surrounding pixel region
-          for(int n = -1; n <= 1; n++){
-            for(int m = -1; m <= 1; m++){
-              if(n != 0 || m != 0){
-                rgb = get_pixel(pic, i+n, j+m);
-                sum_red += rgb.red;
-                sum_green += rgb.green;
-                sum_blue += rgb.blue;
-              }
-            }
-          }
-      
-          // compute average pixel RGB value
-          rgb.red = sum_red / BLUR_REGION_SIZE;
-          rgb.green = sum_green / BLUR_REGION_SIZE;
-          rgb.blue = sum_blue / BLUR_REGION_SIZE;
-        }
-      
-        // set pixel to computed region RBG value (unmodified if boundary)
-        set_pixel(&tmp, i, j, &rgb);
-      }
+    struct picture_view dst;
+    init_result(&tmp, &dst, pic->width, pic->height, pic->bpp);
+    if(!convolve_view_into(&src, &dst, kernel, border)){
+      clear_picture(&tmp);
+      out_of_memory();
     }
     
     // clean-up the old picture and replace with new picture
@@ -169,155 +722,1793 @@
     overwrite_picture(pic, &tmp);
   }
 
-  static void thread_cleanup_handler(void* args)
-  {
-      free(args);
+  void convolve_view(struct picture_view *view, 
+                     const struct convolution_kernel *kernel,
+                     enum border_mode border){
+    if(kernel->uniform && kernel->radius == BOUNDARY_WIDTH && 
+       border == BORDER_COPY){
+      inplace_blur_view(view);
+      return;
+    }
+
+    // make new temporary region-sized picture to work in
+    struct picture tmp;
+    struct picture_view dst;
+    init_result(&tmp, &dst, view->width, view->height, view->parent->bpp);
+    if(!convolve_view_into(view, &dst, kernel, border) || 
+       !view_make_writable(view)){
+      clear_picture(&tmp);
+      out_of_memory();
+    }
+
+    // write the convolved region back into the parent picture
+    for(int j = 0; j < view->height; j++){
+      memcpy(view_row(view, j), picture_row(&tmp, j), 
+             (size_t) view->width * tmp.bpp);
+    }
+    clear_picture(&tmp);
+  }
+
+  void blur_picture(struct picture *pic){
+    struct convolution_kernel box;
+    if(init_box_kernel(&box, BOUNDARY_WIDTH)){
+      convolve_picture(pic, &box, BORDER_COPY);
+      clear_kernel(&box);
+    }
+  }
+
+  void blur_view(struct picture_view *view){
+    struct convolution_kernel box;
+    if(init_box_kernel(&box, BOUNDARY_WIDTH)){
+      convolve_view(view, &box, BORDER_COPY);
+      clear_kernel(&box);
+    }
+  }
+
+  void box_blur_picture(struct picture *pic){
+    blur_picture_with(pic, box_kernel, BOUNDARY_WIDTH);
+  }
+
+  void box_blur_view(struct picture_view *view){
+    blur_view_with(view, box_kernel, BOUNDARY_WIDTH);
+  }
+
+  void simd_blur_picture(struct picture *pic){
+    blur_picture_with(pic, simd_kernel, BOUNDARY_WIDTH);
+  }
+
+  void simd_blur_view(struct picture_view *view){
+    blur_view_with(view, simd_kernel, BOUNDARY_WIDTH);
+  }
+
+  // check a blur radius, aborting on an invalid one as rotate does
+  static void check_blur_radius(struct picture *pic, int radius){
+    if(radius < 1){
+      printf("[!] blur is undefined for radius %i (must be at least 1)\n", 
+             radius);
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+  }
+
+  void integral_blur_picture(struct picture *pic, int radius){
+    check_blur_radius(pic, radius);
+    blur_picture_with(pic, integral_blur_view_into, radius);
+  }
+
+  void integral_blur_view(struct picture_view *view, int radius){
+    check_blur_radius(view->parent, radius);
+    blur_view_with(view, integral_blur_view_into, radius);
+  }
+
+  // check a number of blur passes, aborting on an invalid one as above
+  static void check_blur_passes(struct picture *pic, int passes){
+    if(passes < 1){
+      printf("[!] blur is undefined for %i passes (must be at least 1)\n", 
+             passes);
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
   }
-  
-  static void *single_pixel_worker(void *args) {
-    pthread_cleanup_push(thread_cleanup_handler, args);
-    struct p_work_args *pargs = (struct p_work_args*) args;
-
-    struct pixel rgb;
-
-    int sum_red = 0;
-    int sum_green = 0;
-    int sum_blue = 0;
-
-    for(int n = -1; n <= 1; n++){
-      for(int m = -1; m <= 1; m++){
-        rgb = get_pixel(pargs->orig_pic, pargs->x_coord+n, pargs->y_coord+m);
-        sum_red += rgb.red;
-        sum_green += rgb.green;
-        sum_blue += rgb.blue;
-        }
-      }
-    rgb.red = sum_red / BLUR_REGION_SIZE;
-    rgb.green = sum_green / BLUR_REGION_SIZE;
-    rgb.blue = sum_blue / BLUR_REGION_SIZE;
 
-    set_pixel(pargs->new_pic, pargs->x_coord, pargs->y_coord, &rgb);
+  void fused_blur_picture(struct picture *pic, int passes){
+    check_blur_passes(pic, passes);
+    for(; passes > 0; passes -= FUSED_BLUR_MAX_PASSES){
+      blur_picture_with(pic, fused_blur_view_into, 
+                        passes < FUSED_BLUR_MAX_PASSES ? passes 
+                                                       : FUSED_BLUR_MAX_PASSES);
+    }
+  }
 
-    pthread_cleanup_pop(1);
+  void fused_blur_view(struct picture_view *view, int passes){
+    check_blur_passes(view->parent, passes);
+    for(; passes > 0; passes -= FUSED_BLUR_MAX_PASSES){
+      blur_view_with(view, fused_blur_view_into, 
+                     passes < FUSED_BLUR_MAX_PASSES ? passes 
+                                                    : FUSED_BLUR_MAX_PASSES);
+    }
   }
+
+  void blur_view_into(struct picture_view *src, struct picture_view *dst){
+    struct picture *parent = src->parent;
+    int bpp = parent->bpp;
+    int channels = picture_channels(parent);
+    size_t row_bytes = (size_t) src->width * bpp;
+
+    // region columns that lie inside the parent's boundary pixels
+    int first = src->x == 0 ? BOUNDARY_WIDTH : 0;
+    int last = src->x + src->width == parent->width ? 
+               src->width - BOUNDARY_WIDTH : src->width;
+    if(last < first){
+      last = first;
+    }
   
-  static void *bound_pixel_worker(void *args) {
-    pthread_cleanup_push(thread_cleanup_handler, args);
-    struct p_work_args *pargs = (struct p_work_args*) args;
+    // iterate over each row in the region
+    for(int j = 0 ; j < src->height; j++){
+      const uint8_t *row = view_row(src, j);
+      uint8_t *out = view_row(dst, j);
+
+      // don't need to modify boundary rows of the parent
+      int parent_y = src->y + j;
+      if(parent_y == 0 || parent_y == parent->height - 1){
+        memcpy(out, row, row_bytes);
+        continue;
+      }
 
-    struct pixel rgb = 
-      get_pixel(pargs->orig_pic, pargs->x_coord, pargs->y_coord);
-    set_pixel(pargs->new_pic, pargs->x_coord, pargs->y_coord, &rgb);
+      // or the parent's boundary pixels at either end of the row
+      memcpy(out, row, first * bpp);
+      memcpy(out + last * bpp, row + last * bpp, row_bytes - last * bpp);
 
-    pthread_cleanup_pop(1);
+      const uint8_t *above = row - src->stride;
+      const uint8_t *below = row + src->stride;
+      for(int i = first ; i < last; i++){
+        for(int c = 0; c < channels; c++){
+          ptrdiff_t n = i * bpp + c;
+        
+          // sum the RGB component over the surrounding pixel region
+          int sum = above[n - bpp] + above[n] + above[n + bpp] 
+                  + row[n - bpp] + row[n] + row[n + bpp]
+                  + below[n - bpp] + below[n] + below[n + bpp];
+      
+          // set pixel to the average region RBG value
+          out[n] = sum / BLUR_REGION_SIZE;
+        }
+      }
+    }
   }
 
-  static void thread_join_then_return(struct thread_queue* queue) {
+  // store the 3-tap horizontal sums of n samples from row (neighbouring 
+  // samples of a channel are bpp bytes apart)
+  static void horizontal_sums(const uint8_t *row, uint16_t *sums, size_t n, 
+                              int bpp){
+    for(size_t k = 0; k < n; k++){
+      sums[k] = row[k - bpp] + row[k] + row[k + bpp];
+    }
+  }
 
-    struct thread_node *node_to_rm = dequeue(queue);
-    if (node_to_rm == NULL) {
-      return;
+  // average n samples over the region from the horizontal sums of the 
+  // rows above, on and below them
+  static void vertical_averages(const uint16_t *above, const uint16_t *middle,
+                                const uint16_t *below, uint8_t *out, size_t n){
+    for(size_t k = 0; k < n; k++){
+      out[k] = (above[k] + middle[k] + below[k]) / BLUR_REGION_SIZE;
     }
-    pthread_t *thread_to_join = node_to_rm->thread;
-    free(node_to_rm);
-    pthread_join(*thread_to_join, NULL);
-    free(thread_to_join);
   }
 
-  static void clear_threads(struct thread_queue* queue) {
-    while (!isNull(queue)) {
-      //fprintf(stderr, "Joined a thread!!!");
-      thread_join_then_return(queue);
+#ifdef HAVE_X86_SIMD
+
+  // SSE4.1 versions: 8 samples per instruction
+  __attribute__((target("sse4.1")))
+  static void horizontal_sums_sse4(const uint8_t *row, uint16_t *sums, 
+                                   size_t n, int bpp){
+    size_t k = 0;
+    for(; k + 8 <= n; k += 8){
+      __m128i left = _mm_cvtepu8_epi16(
+                       _mm_loadl_epi64((const __m128i *) (row + k - bpp)));
+      __m128i centre = _mm_cvtepu8_epi16(
+                         _mm_loadl_epi64((const __m128i *) (row + k)));
+      __m128i right = _mm_cvtepu8_epi16(
+                        _mm_loadl_epi64((const __m128i *) (row + k + bpp)));
+      _mm_storeu_si128((__m128i *) (sums + k), 
+                       _mm_add_epi16(_mm_add_epi16(left, centre), right));
     }
+    horizontal_sums(row + k, sums + k, n - k, bpp);
   }
 
-  static void *malloc_clear_if_need(size_t size_to_malloc, 
-                                    struct thread_queue* queue) {
-    void *new_space = malloc(size_to_malloc);
-    while (new_space == NULL) {
-      //fprintf(stderr, "is it stuck here?");
-      thread_join_then_return(queue);
-      new_space = malloc(size_to_malloc);
+  __attribute__((target("sse4.1")))
+  static void vertical_averages_sse4(const uint16_t *above, 
+                                     const uint16_t *middle,
+                                     const uint16_t *below, uint8_t *out, 
+                                     size_t n){
+    const __m128i reciprocal = _mm_set1_epi16(BLUR_RECIPROCAL);
+    size_t k = 0;
+    for(; k + 16 <= n; k += 16){
+      __m128i avg[2];
+      for(int h = 0; h < 2; h++){
+        size_t m = k + 8 * h;
+        __m128i sum = _mm_add_epi16(
+                        _mm_loadu_si128((const __m128i *) (above + m)),
+                        _mm_loadu_si128((const __m128i *) (middle + m)));
+        sum = _mm_add_epi16(sum, 
+                            _mm_loadu_si128((const __m128i *) (below + m)));
+        avg[h] = _mm_mulhi_epu16(sum, reciprocal);
+      }
+      _mm_storeu_si128((__m128i *) (out + k), 
+                       _mm_packus_epi16(avg[0], avg[1]));
     }
-    return new_space;
+    vertical_averages(above + k, middle + k, below + k, out + k, n - k);
   }
 
-  static void make_pixel_thread_loop(void*(*worker_func)(void*), 
-                    struct picture *orig_pic, struct picture *new_pic, 
-                    int x_coord, int y_coord, struct thread_queue* queue) {
-    pthread_t *pixel_worker = malloc_clear_if_need(sizeof(pthread_t), queue);
-    struct p_work_args *pixel_params  = 
-          malloc_clear_if_need(sizeof(struct p_work_args), queue);
-    pixel_params->orig_pic = orig_pic;
-    pixel_params->new_pic = new_pic;
-    pixel_params->x_coord = x_coord;
-    pixel_params->y_coord = y_coord;
+  // AVX2 versions: 16 samples per instruction
+  __attribute__((target("avx2")))
+  static void horizontal_sums_avx2(const uint8_t *row, uint16_t *sums, 
+                                   size_t n, int bpp){
+    size_t k = 0;
+    for(; k + 16 <= n; k += 16){
+      __m256i left = _mm256_cvtepu8_epi16(
+                       _mm_loadu_si128((const __m128i *) (row + k - bpp)));
+      __m256i centre = _mm256_cvtepu8_epi16(
+                         _mm_loadu_si128((const __m128i *) (row + k)));
+      __m256i right = _mm256_cvtepu8_epi16(
+                        _mm_loadu_si128((const __m128i *) (row + k + bpp)));
+      _mm256_storeu_si256((__m256i *) (sums + k), 
+                          _mm256_add_epi16(_mm256_add_epi16(left, centre), 
+                                           right));
+    }
+    horizontal_sums(row + k, sums + k, n - k, bpp);
+  }
 
-    int pthread_create_code = PTHREAD_CREATE_FAIL_CODE;
-    while (pthread_create_code != PTHREAD_CREATE_SUCCESS_CODE) {
-      pthread_create_code = pthread_create(pixel_worker, NULL, 
-                    worker_func, 
-                    pixel_params);
-      thread_join_then_return(queue);
+  __attribute__((target("avx2")))
+  static void vertical_averages_avx2(const uint16_t *above, 
+                                     const uint16_t *middle,
+                                     const uint16_t *below, uint8_t *out, 
+                                     size_t n){
+    const __m256i reciprocal = _mm256_set1_epi16(BLUR_RECIPROCAL);
+    size_t k = 0;
+    for(; k + 32 <= n; k += 32){
+      __m256i avg[2];
+      for(int h = 0; h < 2; h++){
+        size_t m = k + 16 * h;
+        __m256i sum = _mm256_add_epi16(
+                        _mm256_loadu_si256((const __m256i *) (above + m)),
+                        _mm256_loadu_si256((const __m256i *) (middle + m)));
+        sum = _mm256_add_epi16(sum, 
+                         _mm256_loadu_si256((const __m256i *) (below + m)));
+        avg[h] = _mm256_mulhi_epu16(sum, reciprocal);
+      }
+      // packing works within 128-bit lanes, so restore the sample order
+      __m256i packed = _mm256_packus_epi16(avg[0], avg[1]);
+      _mm256_storeu_si256((__m256i *) (out + k), 
+                          _mm256_permute4x64_epi64(packed, 0xD8));
     }
+    vertical_averages(above + k, middle + k, below + k, out + k, n - k);
+  }
+
+#endif
+
+  // The row kernels used by the separable box blur
+  struct blur_row_kernels {
+    const char *isa;
+    void (*sums)(const uint8_t *, uint16_t *, size_t, int);
+    void (*averages)(const uint16_t *, const uint16_t *, const uint16_t *, 
+                     uint8_t *, size_t);
+  };
 
-    struct thread_node *new_node = 
-          malloc_clear_if_need(sizeof(struct thread_node), queue);
-    enqueue(queue, pixel_worker, new_node);
+  static const struct blur_row_kernels scalar_kernels = {
+    "scalar", horizontal_sums, vertical_averages
+  };
+
+  // the fastest kernels this CPU supports, chosen once via cpuid
+  static struct blur_row_kernels simd_kernels;
+  static pthread_once_t simd_kernels_once = PTHREAD_ONCE_INIT;
+
+  static void select_simd_kernels(void){
+    simd_kernels = scalar_kernels;
+  #ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+      simd_kernels = (struct blur_row_kernels) {
+        "avx2", horizontal_sums_avx2, vertical_averages_avx2
+      };
+    } else if(__builtin_cpu_supports("sse4.1")){
+      simd_kernels = (struct blur_row_kernels) {
+        "sse4.1", horizontal_sums_sse4, vertical_averages_sse4
+      };
+    }
+  #endif
   }
 
-  void parallel_blur_picture(struct picture *pic){
-    // make new temporary picture to work in
-    struct picture tmp;
-    init_picture_from_size(&tmp, pic->width, pic->height);
+  static const struct blur_row_kernels *get_simd_kernels(void){
+    pthread_once(&simd_kernels_once, select_simd_kernels);
+    return &simd_kernels;
+  }
 
-    struct thread_queue thread_store;
-    init_queue(&thread_store);
-    
-    // iterate over each pixel in the picture
-    // TODO: Make boundary size adjustable since its still based on
-    // boundary width 1
-
-    //TOP AND BOTTOM BOUNDARY PIXELS
-    for(int i = 0; i<tmp.width; i++) {
-      //fprintf(stderr, "\nNew Pixel Worker at: x:%d y:%d\n", i, 0);
-      //fprintf(stderr, "\nNew Pixel Worker at: x:%d y:%d\n", i, tmp.height);
-      make_pixel_thread_loop(&bound_pixel_worker, 
-                               pic, &tmp, i, 0, 
-                               &thread_store);
-      make_pixel_thread_loop(&bound_pixel_worker, 
-                               pic, &tmp, i, tmp.height - BOUNDARY_WIDTH, 
-                               &thread_store);
-    }
-
-    //LEFT AND RIGHT BOUNDARY PIXELS
-    for(int j = BOUNDARY_WIDTH; j<(tmp.height-BOUNDARY_WIDTH); j++) {
-      //fprintf(stderr, "\nNew Pixel Worker at: x:%d y:%d\n", 0, j);
-      //fprintf(stderr, "\nNew Pixel Worker at: x:%d y:%d\n", tmp.width, j);
-      make_pixel_thread_loop(&bound_pixel_worker, 
-                               pic, &tmp, 0, j, 
-                               &thread_store);
-      make_pixel_thread_loop(&bound_pixel_worker, 
-                               pic, &tmp, tmp.width-BOUNDARY_WIDTH, j, 
-                               &thread_store);
-    }
-
-    //INSIDE PIXELS
-    for(int i = BOUNDARY_WIDTH ; i < tmp.width - BOUNDARY_WIDTH; i++){
-      for(int j = BOUNDARY_WIDTH ; j < tmp.height - BOUNDARY_WIDTH; j++){
-        make_pixel_thread_loop(&single_pixel_worker, 
-                               pic, &tmp, i, j, 
-                               &thread_store);
-
-        //fprintf(stderr, "\nNew Pixel Worker at: x:%d y:%d\n", i, j);
-      }
-    }
-
-    //fprintf(stderr, "Reached the part right before clear threads");
-    clear_threads(&thread_store);
-    //fprintf(stderr, "Reached the part after clear_threads");
-    
-    // clean-up the old picture and replace with new picture
-    clear_picture(pic);
-    overwrite_picture(pic, &tmp);
+  const char *simd_blur_isa(void){
+    return get_simd_kernels()->isa;
   }
+
+  // separable box blur of the region of src into dst using the given row 
+  // kernels (returning false if it ran out of memory)
+  static bool box_blur_with(struct picture_view *src, struct picture_view *dst,
+                            const struct blur_row_kernels *kernels){
+    struct picture *parent = src->parent;
+    int bpp = parent->bpp;
+    size_t row_bytes = (size_t) src->width * bpp;
+
+    // region columns that lie inside the parent's boundary pixels
+    int first = src->x == 0 ? BOUNDARY_WIDTH : 0;
+    int last = src->x + src->width == parent->width ? 
+               src->width - BOUNDARY_WIDTH : src->width;
+    if(last < first){
+      last = first;
+    }
+    size_t start = (size_t) first * bpp;
+    size_t span = (size_t) (last - first) * bpp;
+
+    // horizontal sums of the last three parent rows, indexed by row mod 3
+    uint16_t *sums = malloc(3 * span * sizeof(uint16_t));
+    if(span > 0 && sums == NULL){
+      return false;
+    }
+    int summed = -1;
+
+    // iterate over each row in the region
+    for(int j = 0 ; j < src->height; j++){
+      const uint8_t *row = view_row(src, j);
+      uint8_t *out = view_row(dst, j);
+
+      // don't need to modify boundary rows of the parent
+      int parent_y = src->y + j;
+      if(parent_y == 0 || parent_y == parent->height - 1){
+        memcpy(out, row, row_bytes);
+        continue;
+      }
+
+      // or the parent's boundary pixels at either end of the row
+      memcpy(out, row, start);
+      memcpy(out + start + span, row + start + span, row_bytes - start - span);
+
+      // sum each of the rows above, on and below this one that is not 
+      // already summed (just the row below once the window is rolling)
+      int next = summed + 1 > parent_y - 1 ? summed + 1 : parent_y - 1;
+      for(int y = next; y <= parent_y + 1; y++){
+        const uint8_t *in = row + (y - parent_y) * (ptrdiff_t) src->stride;
+        kernels->sums(in + start, sums + (size_t) (y % 3) * span, span, bpp);
+      }
+      summed = parent_y + 1;
+
+      // add the three horizontal sums and average over the region
+      const uint16_t *above = sums + (size_t) ((parent_y - 1) % 3) * span;
+      const uint16_t *middle = sums + (size_t) (parent_y % 3) * span;
+      const uint16_t *below = sums + (size_t) ((parent_y + 1) % 3) * span;
+      kernels->averages(above, middle, below, out + start, span);
+    }
+    free(sums);
+    return true;
+  }
+
+  bool box_blur_view_into(struct picture_view *src, struct picture_view *dst){
+    return box_blur_with(src, dst, &scalar_kernels);
+  }
+
+  bool simd_blur_view_into(struct picture_view *src, struct picture_view *dst){
+    return box_blur_with(src, dst, get_simd_kernels());
+  }
+
+  // number of row bands to split integral image work into
+  static int band_count(int rows){
+    int cores = core_count();
+    return rows < cores ? (rows > 0 ? rows : 1) : cores;
+  }
+
+  // Integral image of a region: sums[y][x][c] is the total of channel c 
+  // over the area's pixels above row y and left of column x
+  struct integral_image {
+    struct picture_view area;
+    uint64_t *sums;
+    int channels;
+    size_t row_len;
+  };
+
+  // a band of rows [start, end) of integral image, blur or convolution work
+  struct band_work_args {
+    struct integral_image *sat;
+    const struct convolution_kernel *kernel;
+    struct picture_view *src;
+    struct picture_view *dst;
+    int radius;
+    int start;
+    int end;
+    // original rows just above and below the band (in-place work only)
+    uint8_t *halo[2];
+    // parent columns and rows read for positions -radius onwards along 
+    // each (border work only)
+    const int *column_map;
+    const int *row_map;
+  };
+
+  // run worker over each of the bands in args on its own thread, 
+  // returning false if any band's worker returned WORKER_FAILED
+  static bool run_bands(void *(*worker)(void *), struct band_work_args *args,
+                        int bands){
+    bool done = true;
+    if(bands < 1){
+      return done;
+    }
+    pthread_t threads[bands];
+    for(int b = 0; b < bands; b++){
+      if(pthread_create(&threads[b], NULL, worker, &args[b]) != 
+         PTHREAD_CREATE_SUCCESS_CODE){
+        // no thread to spare: do the band here instead
+        done = worker(&args[b]) != WORKER_FAILED && done;
+        threads[b] = pthread_self();
+      }
+    }
+    for(int b = 0; b < bands; b++){
+      if(!pthread_equal(threads[b], pthread_self())){
+        void *result;
+        pthread_join(threads[b], &result);
+        done = done && result != WORKER_FAILED;
+      }
+    }
+    return done;
+  }
+
+  // integral image row y (row 0 is all zeroes, row y sums area rows < y)
+  static uint64_t *integral_row(struct integral_image *sat, int y){
+    return sat->sums + (size_t) y * sat->row_len;
+  }
+
+  // sum each band's rows of the area as if the band started the area
+  static void *integral_band_worker(void *args){
+    struct band_work_args *band = args;
+    struct integral_image *sat = band->sat;
+    int bpp = sat->area.parent->bpp;
+    int channels = sat->channels;
+    for(int y = band->start; y < band->end; y++){
+      const uint8_t *row = view_row(&sat->area, y);
+      uint64_t *sums = integral_row(sat, y + 1);
+      const uint64_t *above = integral_row(sat, y);
+      bool first = y == band->start;
+      uint64_t running[NO_RGB_COMPONENTS] = {0};
+      for(int c = 0; c < channels; c++){
+        sums[c] = 0;
+      }
+      for(int x = 0; x < sat->area.width; x++){
+        for(int c = 0; c < channels; c++){
+          running[c] += row[x * bpp + c];
+          size_t n = (size_t) (x + 1) * channels + c;
+          sums[n] = (first ? 0 : above[n]) + running[c];
+        }
+      }
+    }
+    return NULL;
+  }
+
+  // add the total of the rows before the band to all but its last row
+  static void *integral_offset_worker(void *args){
+    struct band_work_args *band = args;
+    struct integral_image *sat = band->sat;
+    const uint64_t *offset = integral_row(sat, band->start);
+    for(int y = band->start + 1; y < band->end; y++){
+      uint64_t *sums = integral_row(sat, y);
+      for(size_t n = 0; n < sat->row_len; n++){
+        sums[n] += offset[n];
+      }
+    }
+    return NULL;
+  }
+
+  // blur the band's rows of src into dst from the integral image
+  static void *integral_blur_worker(void *args){
+    struct band_work_args *band = args;
+    struct integral_image *sat = band->sat;
+    struct picture_view *src = band->src;
+    struct picture *parent = src->parent;
+    int bpp = parent->bpp;
+    int channels = sat->channels;
+    int radius = band->radius;
+    uint64_t region_size = (uint64_t) (2 * radius + 1) * (2 * radius + 1);
+    size_t row_bytes = (size_t) src->width * bpp;
+
+    // region columns that lie at least radius pixels inside the parent
+    int first = radius - src->x;
+    int last = parent->width - radius - src->x;
+    if(first < 0) first = 0;
+    if(first > src->width) first = src->width;
+    if(last > src->width) last = src->width;
+    if(last < first) last = first;
+
+    for(int j = band->start; j < band->end; j++){
+      const uint8_t *row = view_row(src, j);
+      uint8_t *out = view_row(band->dst, j);
+
+      // don't need to modify the parent's boundary rows
+      int parent_y = src->y + j;
+      if(parent_y < radius || parent_y >= parent->height - radius){
+        memcpy(out, row, row_bytes);
+        continue;
+      }
+
+      // or its boundary pixels at either end of the row
+      memcpy(out, row, (size_t) first * bpp);
+      memcpy(out + (size_t) last * bpp, row + (size_t) last * bpp, 
+             row_bytes - (size_t) last * bpp);
+
+      // integral rows bounding the region above and below the pixel
+      int area_y = parent_y - sat->area.y;
+      const uint64_t *top = integral_row(sat, area_y - radius);
+      const uint64_t *bottom = integral_row(sat, area_y + radius + 1);
+      for(int i = first; i < last; i++){
+        int area_x = src->x + i - sat->area.x;
+        size_t left = (size_t) (area_x - radius) * channels;
+        size_t right = (size_t) (area_x + radius + 1) * channels;
+        uint8_t *rgb = out + i * bpp;
+        for(int c = 0; c < channels; c++){
+          uint64_t sum = bottom[right + c] - bottom[left + c] 
+                       - top[right + c] + top[left + c];
+          rgb[c] = sum / region_size;
+        }
+      }
+    }
+    return NULL;
+  }
+
+  bool integral_blur_view_into(struct picture_view *src, 
+                               struct picture_view *dst, int radius){
+    struct picture *parent = src->parent;
+    struct integral_image sat;
+
+    // sum the region together with the radius-wide margin around it
+    int x0 = src->x - radius > 0 ? src->x - radius : 0;
+    int y0 = src->y - radius > 0 ? src->y - radius : 0;
+    int x1 = src->x + src->width + radius < parent->width ? 
+             src->x + src->width + radius : parent->width;
+    int y1 = src->y + src->height + radius < parent->height ? 
+             src->y + src->height + radius : parent->height;
+    init_picture_view(&sat.area, parent, x0, y0, x1 - x0, y1 - y0);
+    sat.channels = picture_channels(parent);
+    sat.row_len = (size_t) (sat.area.width + 1) * sat.channels;
+    sat.sums = malloc((size_t) (sat.area.height + 1) * sat.row_len * 
+                      sizeof(uint64_t));
+    if(sat.sums == NULL){
+      return false;
+    }
+    memset(integral_row(&sat, 0), 0, sat.row_len * sizeof(uint64_t));
+
+    // build the integral image band by band: each band is summed on its 
+    // own, then the band totals are carried down (each band's last row 
+    // in turn, then the rest of the rows in parallel)
+    int bands = band_count(sat.area.height);
+    struct band_work_args args[bands];
+    for(int b = 0; b < bands; b++){
+      args[b].sat = &sat;
+      args[b].kernel = NULL;
+      args[b].halo[0] = args[b].halo[1] = NULL;
+      args[b].src = src;
+      args[b].dst = dst;
+      args[b].radius = radius;
+      args[b].start = (int) ((long) sat.area.height * b / bands);
+      args[b].end = (int) ((long) sat.area.height * (b + 1) / bands);
+    }
+    run_bands(integral_band_worker, args, bands);
+    for(int b = 1; b < bands; b++){
+      uint64_t *last = integral_row(&sat, args[b].end);
+      const uint64_t *offset = integral_row(&sat, args[b].start);
+      for(size_t n = 0; n < sat.row_len; n++){
+        last[n] += offset[n];
+      }
+    }
+    run_bands(integral_offset_worker, args + 1, bands - 1);
+
+    // then blur the region's rows in bands
+    bands = band_count(src->height);
+    for(int b = 0; b < bands; b++){
+      args[b].start = (int) ((long) src->height * b / bands);
+      args[b].end = (int) ((long) src->height * (b + 1) / bands);
+    }
+    run_bands(integral_blur_worker, args, bands);
+    free(sat.sums);
+    return true;
+  }
+
+  // bounds [x0, x1) x [y0, y1) of a rectangle of parent pixels
+  struct pixel_rect {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+  };
+
+  // grow rect by margin pixels on every side, clipped to the parent
+  static struct pixel_rect grow_rect(struct pixel_rect rect, int margin,
+                                     struct picture *parent){
+    rect.x0 = rect.x0 - margin > 0 ? rect.x0 - margin : 0;
+    rect.y0 = rect.y0 - margin > 0 ? rect.y0 - margin : 0;
+    rect.x1 = rect.x1 + margin < parent->width ? rect.x1 + margin 
+                                               : parent->width;
+    rect.y1 = rect.y1 + margin < parent->height ? rect.y1 + margin 
+                                                : parent->height;
+    return rect;
+  }
+
+  // run the given number of blur passes over one tile of src (in parent 
+  // coordinates), writing the tile of the result into dst
+  static void fused_blur_tile(struct picture_view *src, 
+                              struct picture_view *dst, struct pixel_rect tile,
+                              int passes, uint8_t *patches[2], uint16_t *sums,
+                              const struct blur_row_kernels *kernels){
+    struct picture *parent = src->parent;
+    int bpp = parent->bpp;
+
+    // pixels the tile depends on after all passes, and the region's pixels 
+    // that a pass changes (the rest keep their original values throughout)
+    struct pixel_rect patch = grow_rect(tile, passes, parent);
+    struct pixel_rect blurred = {
+      src->x > BOUNDARY_WIDTH ? src->x : BOUNDARY_WIDTH,
+      src->y > BOUNDARY_WIDTH ? src->y : BOUNDARY_WIDTH,
+      src->x + src->width < parent->width - BOUNDARY_WIDTH ? 
+        src->x + src->width : parent->width - BOUNDARY_WIDTH,
+      src->y + src->height < parent->height - BOUNDARY_WIDTH ? 
+        src->y + src->height : parent->height - BOUNDARY_WIDTH
+    };
+    size_t stride = (size_t) (patch.x1 - patch.x0) * bpp;
+
+    // load the patch, then blur it from one buffer into the other, each 
+    // pass over a margin one pixel narrower than the last
+    for(int y = patch.y0; y < patch.y1; y++){
+      memcpy(patches[0] + (y - patch.y0) * stride, 
+             view_row(src, y - src->y) + (ptrdiff_t) (patch.x0 - src->x) * bpp,
+             stride);
+    }
+    for(int pass = 1; pass <= passes; pass++){
+      const uint8_t *in = patches[(pass - 1) % 2];
+      uint8_t *out = patches[pass % 2];
+      struct pixel_rect area = grow_rect(tile, passes - pass, parent);
+      int x0 = area.x0 > blurred.x0 ? area.x0 : blurred.x0;
+      int x1 = area.x1 < blurred.x1 ? area.x1 : blurred.x1;
+      if(x1 < x0){
+        x1 = x0;
+      }
+      size_t start = (size_t) (area.x0 - patch.x0) * bpp;
+      size_t first = (size_t) (x0 - patch.x0) * bpp;
+      size_t last = (size_t) (x1 - patch.x0) * bpp;
+      size_t end = (size_t) (area.x1 - patch.x0) * bpp;
+      size_t span = last - first;
+      int summed = -1;
+
+      for(int y = area.y0; y < area.y1; y++){
+        const uint8_t *row = in + (y - patch.y0) * stride;
+        uint8_t *target = out + (y - patch.y0) * stride;
+
+        // pixels outside the blurred area keep their values
+        if(y < blurred.y0 || y >= blurred.y1){
+          memcpy(target + start, row + start, end - start);
+          continue;
+        }
+        memcpy(target + start, row + start, first - start);
+        memcpy(target + last, row + last, end - last);
+
+        // horizontal sums of the rows not yet summed, as in box_blur_with
+        int next = summed + 1 > y - 1 ? summed + 1 : y - 1;
+        for(int r = next; r <= y + 1; r++){
+          kernels->sums(in + (r - patch.y0) * stride + first, 
+                        sums + (size_t) (r % 3) * span, span, bpp);
+        }
+        summed = y + 1;
+        kernels->averages(sums + (size_t) ((y - 1) % 3) * span, 
+                          sums + (size_t) (y % 3) * span,
+                          sums + (size_t) ((y + 1) % 3) * span, 
+                          target + first, span);
+      }
+    }
+
+    // write the finished tile out
+    const uint8_t *result = patches[passes % 2];
+    size_t tile_bytes = (size_t) (tile.x1 - tile.x0) * bpp;
+    for(int y = tile.y0; y < tile.y1; y++){
+      memcpy(view_row(dst, y - src->y) + (size_t) (tile.x0 - src->x) * bpp,
+             result + (y - patch.y0) * stride + (size_t) (tile.x0 - patch.x0) 
+                                                * bpp,
+             tile_bytes);
+    }
+  }
+
+  // blur the band's rows of tiles of src into dst
+  static void *fused_blur_worker(void *args){
+    struct band_work_args *band = args;
+    struct picture_view *src = band->src;
+    int passes = band->radius;
+    int bpp = src->parent->bpp;
+
+    // a tile with its halo, twice over, and a ring of three sum rows
+    size_t patch_width = (size_t) FUSED_BLUR_TILE_SIZE + 2 * passes;
+    uint8_t *patches[2];
+    patches[0] = malloc(2 * patch_width * patch_width * bpp);
+    patches[1] = patches[0] + patch_width * patch_width * bpp;
+    uint16_t *sums = malloc(3 * patch_width * bpp * sizeof(uint16_t));
+    if(patches[0] == NULL || sums == NULL){
+      free(patches[0]);
+      free(sums);
+      return WORKER_FAILED;
+    }
+
+    const struct blur_row_kernels *kernels = get_simd_kernels();
+    for(int ty = band->start; ty < band->end; ty++){
+      for(int tx = 0; tx < src->width; tx += FUSED_BLUR_TILE_SIZE){
+        struct pixel_rect tile = {
+          src->x + tx, src->y + ty * FUSED_BLUR_TILE_SIZE,
+          src->x + tx + FUSED_BLUR_TILE_SIZE, 
+          src->y + (ty + 1) * FUSED_BLUR_TILE_SIZE
+        };
+        if(tile.x1 > src->x + src->width) tile.x1 = src->x + src->width;
+        if(tile.y1 > src->y + src->height) tile.y1 = src->y + src->height;
+        fused_blur_tile(src, band->dst, tile, passes, patches, sums, 
+                        kernels);
+      }
+    }
+    free(patches[0]);
+    free(sums);
+    return NULL;
+  }
+
+  bool fused_blur_view_into(struct picture_view *src, struct picture_view *dst,
+                            int passes){
+    // split the rows of tiles into bands, one per thread
+    int tile_rows = (src->height + FUSED_BLUR_TILE_SIZE - 1) / 
+                    FUSED_BLUR_TILE_SIZE;
+    int bands = band_count(tile_rows);
+    struct band_work_args args[bands];
+    for(int b = 0; b < bands; b++){
+      args[b].sat = NULL;
+      args[b].kernel = NULL;
+      args[b].halo[0] = args[b].halo[1] = NULL;
+      args[b].src = src;
+      args[b].dst = dst;
+      args[b].radius = passes;
+      args[b].start = (int) ((long) tile_rows * b / bands);
+      args[b].end = (int) ((long) tile_rows * (b + 1) / bands);
+    }
+    return run_bands(fused_blur_worker, args, bands);
+  }
+
+  // tiles of a parallel transform, handed out to workers in order as they
+  // become free
+  struct tile_queue {
+    struct picture_view *src;
+    struct picture_view *dst;
+    int tile_width;
+    int tile_height;
+    // radius of the transform's neighbourhood, where it has one
+    int radius;
+    int tiles_across;
+    int tiles;
+    atomic_int next;
+  };
+
+  // set up a queue of the tiles of the region of src, returning the 
+  // number of threads worth starting for them (one per core if threads is
+  // less than 1, and no more than there are tiles)
+  static int init_tile_queue(struct tile_queue *queue, 
+                             struct picture_view *src, 
+                             struct picture_view *dst, int tile_width, 
+                             int tile_height, int radius, int threads){
+    queue->src = src;
+    queue->dst = dst;
+    queue->tile_width = tile_width;
+    queue->tile_height = tile_height;
+    queue->radius = radius;
+    queue->tiles_across = (src->width + tile_width - 1) / tile_width;
+    queue->tiles = queue->tiles_across * 
+                   ((src->height + tile_height - 1) / tile_height);
+    atomic_init(&queue->next, 0);
+    if(threads < 1){
+      threads = core_count();
+    }
+    if(threads > queue->tiles){
+      threads = queue->tiles > 0 ? queue->tiles : 1;
+    }
+    return threads;
+  }
+
+  // take the next tile from the queue as views of src and dst, if any are 
+  // left (the tile's neighbours are read from the source picture around 
+  // it)
+  static bool next_tile(struct tile_queue *queue, struct picture_view *src,
+                        struct picture_view *dst){
+    int t = atomic_fetch_add(&queue->next, 1);
+    if(t >= queue->tiles){
+      return false;
+    }
+    int x = t % queue->tiles_across * queue->tile_width;
+    int y = t / queue->tiles_across * queue->tile_height;
+    int width = queue->src->width - x < queue->tile_width ? 
+                queue->src->width - x : queue->tile_width;
+    int height = queue->src->height - y < queue->tile_height ? 
+                 queue->src->height - y : queue->tile_height;
+    init_picture_view(src, queue->src->parent, queue->src->x + x, 
+                      queue->src->y + y, width, height);
+    init_picture_view(dst, queue->dst->parent, queue->dst->x + x, 
+                      queue->dst->y + y, width, height);
+    return true;
+  }
+
+  // blur tiles from the queue until none are left
+  static void *tiled_blur_worker(void *args){
+    struct tile_queue *queue = args;
+    const struct blur_row_kernels *kernels = get_simd_kernels();
+    struct picture_view src, dst;
+    while(next_tile(queue, &src, &dst)){
+      if(!box_blur_with(&src, &dst, kernels)){
+        return WORKER_FAILED;
+      }
+    }
+    return NULL;
+  }
+
+  bool tiled_blur_view_into(struct picture_view *src, struct picture_view *dst,
+                            int threads){
+    struct tile_queue queue;
+    threads = init_tile_queue(&queue, src, dst, BLUR_TILE_SIZE, 
+                              BLUR_TILE_SIZE, BOUNDARY_WIDTH, threads);
+    return run_workers(tiled_blur_worker, &queue, threads);
+  }
+
+  void tiled_blur_picture(struct picture *pic, int threads){
+    blur_picture_with(pic, tiled_blur_view_into, threads);
+  }
+
+  void tiled_blur_view(struct picture_view *view, int threads){
+    blur_view_with(view, tiled_blur_view_into, threads);
+  }
+
+  // smallest sigma the recursive Gaussian's coefficients are fitted for
+  #define MIN_GAUSSIAN_SIGMA 0.5
+  // rows a worker takes at a time in the recursive Gaussian's row pass
+  #define GAUSSIAN_ROW_CHUNK 16
+
+  // coefficients of a recursive Gaussian filter, normalised so that 
+  // y[n] = gain * x[n] + b[0] * y[n-1] + b[1] * y[n-2] + b[2] * y[n-3]
+  struct gaussian_filter {
+    double gain;
+    double b[3];
+    // maps the causal pass's last three outputs to the anti-causal 
+    // pass's first three (3x3, row by row)
+    double edge[9];
+  };
+
+  // rows or column blocks of a recursive Gaussian blur, taken by workers 
+  // from next onwards
+  struct gaussian_work_args {
+    struct picture_view *view;
+    const struct gaussian_filter *filter;
+    atomic_int next;
+  };
+
+  // Young and van Vliet's recursive Gaussian coefficients for sigma
+  static void init_gaussian_filter(struct gaussian_filter *filter, 
+                                   double sigma){
+    double q = sigma >= 2.5 ? 0.98711 * sigma - 0.96330 
+                            : 3.97156 - 4.14554 * sqrt(1 - 0.26891 * sigma);
+    double b0 = 1.57825 + 2.44413 * q + 1.4281 * q * q + 
+                0.422205 * q * q * q;
+    filter->b[0] = (2.44413 * q + 2.85619 * q * q + 1.26661 * q * q * q) / b0;
+    filter->b[1] = -(1.4281 * q * q + 1.26661 * q * q * q) / b0;
+    filter->b[2] = 0.422205 * q * q * q / b0;
+    filter->gain = 1 - (filter->b[0] + filter->b[1] + filter->b[2]);
+
+    // Triggs and Sdika's matrix giving the anti-causal pass's starting 
+    // state from the causal pass's final one
+    double a1 = filter->b[0], a2 = filter->b[1], a3 = filter->b[2];
+    double scale = 1 / ((1 + a1 - a2 + a3) * (1 - a1 - a2 - a3) * 
+                        (1 + a2 + (a1 - a3) * a3));
+    double *m = filter->edge;
+    m[0] = scale * (-a3 * a1 + 1 - a3 * a3 - a2);
+    m[1] = scale * (a3 + a1) * (a2 + a3 * a1);
+    m[2] = scale * a3 * (a1 + a3 * a2);
+    m[3] = scale * (a1 + a3 * a2);
+    m[4] = -scale * (a2 - 1) * (a2 + a3 * a1);
+    m[5] = -scale * a3 * (a3 * a1 + a3 * a3 + a2 - 1);
+    m[6] = scale * (a3 * a1 + a2 + a1 * a1 - a2 * a2);
+    m[7] = scale * (a1 * a2 + a3 * a2 * a2 - a1 * a3 * a3 - a3 * a3 * a3 - 
+                    a3 * a2 + a3);
+    m[8] = scale * a3 * (a1 + a3 * a2);
+  }
+
+  // Filter n lines of samples at once, each with len samples step apart 
+  // (and neighbouring lines one sample apart), causally then 
+  // anti-causally, in work: room for len + 6 rows of n doubles. Both 
+  // passes start as if the edge sample were repeated beyond the edge.
+  static void gaussian_lines(const struct gaussian_filter *filter, 
+                             uint8_t *samples, ptrdiff_t step, int len, 
+                             int n, double *work){
+    const double *b = filter->b;
+    double *w = work + 3 * (size_t) n;
+    for(int k = 0; k < n; k++){
+      w[k - n] = w[k - 2 * n] = w[k - 3 * n] = samples[k];
+    }
+    for(int i = 0; i < len; i++){
+      const uint8_t *in = samples + i * step;
+      double *out = w + (size_t) i * n;
+      for(int k = 0; k < n; k++){
+        out[k] = filter->gain * in[k] + b[0] * out[k - n] + 
+                 b[1] * out[k - 2 * n] + b[2] * out[k - 3 * n];
+      }
+    }
+
+    // the anti-causal pass overwrites each row once it is filtered, 
+    // starting from the exact state at the end of the line
+    const double *m = filter->edge;
+    double *last = w + (size_t) (len - 1) * n;
+    const uint8_t *edge = samples + (len - 1) * step;
+    for(int k = 0; k < n; k++){
+      double e[3] = {last[k] - edge[k], last[k - n] - edge[k], 
+                     last[k - 2 * n] - edge[k]};
+      for(int r = 2; r >= 0; r--){
+        last[k + r * n] = filter->gain * (m[3 * r] * e[0] + 
+                          m[3 * r + 1] * e[1] + m[3 * r + 2] * e[2]) + 
+                          edge[k];
+      }
+    }
+    for(int i = len - 1; i >= 0; i--){
+      uint8_t *out = samples + i * step;
+      double *y = w + (size_t) i * n;
+      for(int k = 0; k < n; k++){
+        if(i < len - 1){
+          y[k] = filter->gain * y[k] + b[0] * y[k + n] + 
+                 b[1] * y[k + 2 * n] + b[2] * y[k + 3 * n];
+        }
+        out[k] = y[k] < 0 ? 0 : (y[k] > MAX_PIXEL_INTENSITY ? 
+                                 MAX_PIXEL_INTENSITY : lrint(y[k]));
+      }
+    }
+  }
+
+  // filter chunks of rows along their length until none are left
+  static void *gaussian_row_worker(void *args){
+    struct gaussian_work_args *work = args;
+    struct picture_view *view = work->view;
+    int bpp = view->parent->bpp;
+    int channels = picture_channels(view->parent);
+    double *line = malloc(((size_t) view->width + 6) * channels * 
+                          sizeof(double));
+    if(line == NULL){
+      return WORKER_FAILED;
+    }
+    for(int j = atomic_fetch_add(&work->next, GAUSSIAN_ROW_CHUNK); 
+        j < view->height; 
+        j = atomic_fetch_add(&work->next, GAUSSIAN_ROW_CHUNK)){
+      int end = j + GAUSSIAN_ROW_CHUNK < view->height ? 
+                j + GAUSSIAN_ROW_CHUNK : view->height;
+      for(; j < end; j++){
+        // each channel of the row is a line of samples bpp bytes apart
+        gaussian_lines(work->filter, view_row(view, j), bpp, view->width, 
+                       channels, line);
+      }
+    }
+    free(line);
+    return NULL;
+  }
+
+  // filter blocks of whole cache lines' worth of columns down their 
+  // length until none are left (the block's samples in each row are 
+  // contiguous, so every column of the block is filtered at once)
+  static void *gaussian_column_worker(void *args){
+    struct gaussian_work_args *work = args;
+    struct picture_view *view = work->view;
+    int bpp = view->parent->bpp;
+    int block = picture_line_pixels(view->parent);
+    double *lines = malloc(((size_t) view->height + 6) * block * bpp * 
+                           sizeof(double));
+    if(lines == NULL){
+      return WORKER_FAILED;
+    }
+    for(int x = atomic_fetch_add(&work->next, block); x < view->width; 
+        x = atomic_fetch_add(&work->next, block)){
+      int width = view->width - x < block ? view->width - x : block;
+      gaussian_lines(work->filter, view->pixels + (size_t) x * bpp, 
+                     view->stride, view->height, width * bpp, lines);
+    }
+    free(lines);
+    return NULL;
+  }
+
+  // the recursive Gaussian filters a region in place, as if it were a 
+  // picture of its own, at a cost per pixel independent of sigma
+  void gaussian_blur_picture(struct picture *pic, double sigma){
+    struct picture_view view;
+    if(!init_full_view(&view, pic)){
+      out_of_memory();
+    }
+    gaussian_blur_view(&view, sigma);
+  }
+
+  void gaussian_blur_view(struct picture_view *view, double sigma){
+    if(!(sigma >= MIN_GAUSSIAN_SIGMA)){
+      printf("[!] gaussian-blur is undefined for sigma %g (must be at least "
+             "%g)\n", sigma, MIN_GAUSSIAN_SIGMA);
+      clear_picture(view->parent);
+      exit(IO_ERROR);
+    }
+    if(!view_make_writable(view)){
+      out_of_memory();
+    }
+    struct gaussian_filter filter;
+    init_gaussian_filter(&filter, sigma);
+    struct gaussian_work_args work = {view, &filter, 0};
+
+    // rows in parallel, then columns in parallel blocks (the region is 
+    // filtered in place, so running out of memory part way aborts)
+    int threads = core_count();
+    if(!run_workers(gaussian_row_worker, &work, threads)){
+      out_of_memory();
+    }
+    atomic_store(&work.next, 0);
+    if(!run_workers(gaussian_column_worker, &work, threads)){
+      out_of_memory();
+    }
+  }
+
+  // size of the tiles a median filter hands out
+  #define MEDIAN_TILE_WIDTH 256
+  #define MEDIAN_TILE_HEIGHT 256
+
+  // Histogram of a channel's samples for the median filter: a count of 
+  // each value, and of each run of 1 << MEDIAN_COARSE_SHIFT values
+  #define MEDIAN_FINE_BINS 256
+  #define MEDIAN_COARSE_SHIFT 4
+  #define MEDIAN_COARSE_BINS (MEDIAN_FINE_BINS >> MEDIAN_COARSE_SHIFT)
+  struct median_histogram {
+    uint16_t coarse[MEDIAN_COARSE_BINS];
+    uint16_t fine[MEDIAN_FINE_BINS];
+  };
+
+  static void histogram_insert(struct median_histogram *h, uint8_t v){
+    h->coarse[v >> MEDIAN_COARSE_SHIFT]++;
+    h->fine[v]++;
+  }
+
+  static void histogram_remove(struct median_histogram *h, uint8_t v){
+    h->coarse[v >> MEDIAN_COARSE_SHIFT]--;
+    h->fine[v]--;
+  }
+
+  // Kernel histogram of a channel for the median filter, summing taps 
+  // column histograms that lie channels apart. Its coarse counts follow
+  // the kernel at every step along a row, but each coarse bin's run of 
+  // fine counts is only brought up to date when the median search goes 
+  // into it, from the column position it was last brought up to date at
+  struct median_kernel {
+    struct median_histogram counts;
+    int updated[MEDIAN_COARSE_BINS];
+  };
+
+  // start the kernel at column position 0 of a row (with every run of 
+  // fine counts out of date)
+  static void kernel_start(struct median_kernel *kernel, 
+                           const struct median_histogram *columns, 
+                           int taps, int channels){
+    memset(kernel->counts.coarse, 0, sizeof(kernel->counts.coarse));
+    for(int i = 0; i < taps; i++){
+      const uint16_t *coarse = columns[i * channels].coarse;
+      for(int b = 0; b < MEDIAN_COARSE_BINS; b++){
+        kernel->counts.coarse[b] += coarse[b];
+      }
+    }
+    for(int b = 0; b < MEDIAN_COARSE_BINS; b++){
+      kernel->updated[b] = -taps;
+    }
+  }
+
+  // move the kernel's coarse counts on a column, from position pos
+  static void kernel_step(struct median_kernel *kernel, 
+                          const struct median_histogram *columns, int pos, 
+                          int taps, int channels){
+    const uint16_t *in = columns[(pos + taps) * channels].coarse;
+    const uint16_t *out = columns[pos * channels].coarse;
+    for(int b = 0; b < MEDIAN_COARSE_BINS; b++){
+      kernel->counts.coarse[b] += in[b] - out[b];
+    }
+  }
+
+  // bring coarse bin b's run of fine counts up to date at position pos: 
+  // step it along the columns passed since it was last up to date, or 
+  // recount it if the kernel has moved on by its whole width since
+  static void kernel_update(struct median_kernel *kernel, 
+                            const struct median_histogram *columns, int b, 
+                            int pos, int taps, int channels){
+    int from = kernel->updated[b];
+    int first_value = b << MEDIAN_COARSE_SHIFT;
+    uint16_t *fine = kernel->counts.fine + first_value;
+    int run = 1 << MEDIAN_COARSE_SHIFT;
+    if(pos - from >= taps){
+      memset(fine, 0, run * sizeof(*fine));
+      for(int i = pos; i < pos + taps; i++){
+        const uint16_t *add = columns[i * channels].fine + first_value;
+        for(int v = 0; v < run; v++){
+          fine[v] += add[v];
+        }
+      }
+    } else {
+      for(int i = from; i < pos; i++){
+        const uint16_t *add = columns[(i + taps) * channels].fine + 
+                              first_value;
+        const uint16_t *sub = columns[i * channels].fine + first_value;
+        for(int v = 0; v < run; v++){
+          fine[v] += add[v] - sub[v];
+        }
+      }
+    }
+    kernel->updated[b] = pos;
+  }
+
+  // the value of the given rank (counting from 0) in the kernel at 
+  // position pos: its coarse bin first, then the value within that bin 
+  // once the bin's fine counts are up to date
+  static uint8_t kernel_rank(struct median_kernel *kernel, 
+                             const struct median_histogram *columns, 
+                             int pos, int taps, int channels, int rank){
+    int b = 0;
+    while(rank >= kernel->counts.coarse[b]){
+      rank -= kernel->counts.coarse[b++];
+    }
+    kernel_update(kernel, columns, b, pos, taps, channels);
+    int v = b << MEDIAN_COARSE_SHIFT;
+    while(rank >= kernel->counts.fine[v]){
+      rank -= kernel->counts.fine[v++];
+    }
+    return v;
+  }
+
+  // add (or with sign -1, remove) row j of src to the histograms of the 
+  // n columns from column x, channels histograms per column
+  static void histogram_row(struct median_histogram *columns, 
+                            struct picture_view *src, int j, int x, int n,
+                            int channels, int sign){
+    int bpp = src->parent->bpp;
+    const uint8_t *row = view_row(src, j) + (ptrdiff_t) x * bpp;
+    for(int i = 0; i < n; i++){
+      for(int c = 0; c < channels; c++){
+        if(sign > 0){
+          histogram_insert(&columns[i * channels + c], row[i * bpp + c]);
+        } else {
+          histogram_remove(&columns[i * channels + c], row[i * bpp + c]);
+        }
+      }
+    }
+  }
+
+  // median filter a tile of src into dst (Perreault and Hebert's constant 
+  // time algorithm): each column keeps a histogram of the samples within 
+  // radius of the current row, and a kernel histogram slides along the 
+  // row adding the column coming into range and removing the one leaving
+  // (only its coarse counts at every step, its fine counts as needed)
+  static void median_tile(struct picture_view *src, struct picture_view *dst,
+                          int radius, struct median_histogram *columns,
+                          struct median_kernel *kernel){
+    struct picture *parent = src->parent;
+    int bpp = parent->bpp;
+    int channels = picture_channels(parent);
+    size_t row_bytes = (size_t) src->width * bpp;
+
+    // tile pixels that lie at least radius pixels inside the parent
+    int first = radius - src->x;
+    int last = parent->width - radius - src->x;
+    int top = radius - src->y;
+    int bottom = parent->height - radius - src->y;
+    if(first < 0) first = 0;
+    if(first > src->width) first = src->width;
+    if(last > src->width) last = src->width;
+    if(last < first) last = first;
+    if(top < 0) top = 0;
+    if(top > src->height) top = src->height;
+    if(bottom > src->height) bottom = src->height;
+    if(bottom < top) bottom = top;
+
+    // the rest are copied as-is
+    for(int j = 0; j < src->height; j++){
+      const uint8_t *row = view_row(src, j);
+      uint8_t *out = view_row(dst, j);
+      if(j < top || j >= bottom || first == last){
+        memcpy(out, row, row_bytes);
+      } else {
+        memcpy(out, row, (size_t) first * bpp);
+        memcpy(out + (size_t) last * bpp, row + (size_t) last * bpp, 
+               row_bytes - (size_t) last * bpp);
+      }
+    }
+    if(first == last || top == bottom){
+      return;
+    }
+
+    // column histograms of the rows above the first row to filter
+    int n = last - first + 2 * radius;
+    int taps = 2 * radius + 1;
+    int rank = taps * taps / 2;
+    memset(columns, 0, (size_t) n * channels * sizeof(*columns));
+    for(int j = top - radius; j < top + radius; j++){
+      histogram_row(columns, src, j, first - radius, n, channels, 1);
+    }
+
+    for(int j = top; j < bottom; j++){
+      histogram_row(columns, src, j + radius, first - radius, n, channels, 1);
+      for(int c = 0; c < channels; c++){
+        kernel_start(&kernel[c], &columns[c], taps, channels);
+      }
+
+      uint8_t *out = view_row(dst, j);
+      for(int i = first; i < last; i++){
+        int pos = i - first;
+        for(int c = 0; c < channels; c++){
+          out[i * bpp + c] = kernel_rank(&kernel[c], &columns[c], pos, taps, 
+                                         channels, rank);
+        }
+        if(i + 1 < last){
+          for(int c = 0; c < channels; c++){
+            kernel_step(&kernel[c], &columns[c], pos, taps, channels);
+          }
+        }
+      }
+      histogram_row(columns, src, j - radius, first - radius, n, channels, 
+                    -1);
+    }
+  }
+
+  // median filter tiles from the queue until none are left
+  static void *median_worker(void *args){
+    struct tile_queue *queue = args;
+    int channels = picture_channels(queue->src->parent);
+    struct median_histogram *columns = 
+      malloc((size_t) (queue->tile_width + 2 * queue->radius) * channels * 
+             sizeof(struct median_histogram));
+    struct median_kernel *kernel = 
+      malloc(channels * sizeof(struct median_kernel));
+    bool ready = columns != NULL && kernel != NULL;
+    if(ready){
+      struct picture_view src, dst;
+      while(next_tile(queue, &src, &dst)){
+        median_tile(&src, &dst, queue->radius, columns, kernel);
+      }
+    }
+    free(columns);
+    free(kernel);
+    return ready ? NULL : WORKER_FAILED;
+  }
+
+  bool median_view_into(struct picture_view *src, struct picture_view *dst,
+                        int radius){
+    struct tile_queue queue;
+    int threads = init_tile_queue(&queue, src, dst, MEDIAN_TILE_WIDTH, 
+                                  MEDIAN_TILE_HEIGHT, radius, 0);
+    return run_workers(median_worker, &queue, threads);
+  }
+
+  // check a median radius, aborting on an invalid one as rotate does
+  static void check_median_radius(struct picture *pic, int radius){
+    if(radius < 1 || radius > KERNEL_MAX_RADIUS){
+      printf("[!] median is undefined for radius %i (must be 1 to %i)\n", 
+             radius, KERNEL_MAX_RADIUS);
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+  }
+
+  void median_picture(struct picture *pic, int radius){
+    check_median_radius(pic, radius);
+    blur_picture_with(pic, median_view_into, radius);
+  }
+
+  void median_view(struct picture_view *view, int radius){
+    check_median_radius(view->parent, radius);
+    blur_view_with(view, median_view_into, radius);
+  }
+
+  // row j of the view as it was before an in-place blur began (the rows 
+  // either side of the band are read from the copies saved of them, as the
+  // neighbouring bands overwrite them)
+  static const uint8_t *original_row(struct band_work_args *band, int j){
+    int bpp = band->src->parent->bpp;
+    if(j == band->start - 1 && band->halo[0] != NULL){
+      return band->halo[0] + bpp;
+    }
+    if(j == band->end && band->halo[1] != NULL){
+      return band->halo[1] + bpp;
+    }
+    return view_row(band->src, j);
+  }
+
+  // copy row j of the view, with the pixel either side of it in the 
+  // parent, into a buffer with a pixel of margin at each end
+  static uint8_t *save_view_row(struct picture_view *view, int j){
+    struct picture *parent = view->parent;
+    int bpp = parent->bpp;
+    uint8_t *saved = malloc((size_t) (view->width + 2) * bpp);
+    if(saved != NULL){
+      int left = view->x > 0 ? 1 : 0;
+      int right = view->x + view->width < parent->width ? 1 : 0;
+      memcpy(saved + (size_t) (1 - left) * bpp, 
+             view_row(view, j) - (ptrdiff_t) left * bpp, 
+             (size_t) (view->width + left + right) * bpp);
+    }
+    return saved;
+  }
+
+  // blur the band's rows of the view in place, keeping the horizontal sums
+  // of the original rows above, on and below each row in a ring
+  static void *inplace_blur_worker(void *args){
+    struct band_work_args *band = args;
+    struct picture_view *view = band->src;
+    struct picture *parent = view->parent;
+    int bpp = parent->bpp;
+    const struct blur_row_kernels *kernels = get_simd_kernels();
+
+    // region columns that lie inside the parent's boundary pixels
+    int first = view->x == 0 ? BOUNDARY_WIDTH : 0;
+    int last = view->x + view->width == parent->width ? 
+               view->width - BOUNDARY_WIDTH : view->width;
+    if(last < first){
+      last = first;
+    }
+    size_t start = (size_t) first * bpp;
+    size_t span = (size_t) (last - first) * bpp;
+
+    uint16_t *sums = malloc(3 * span * sizeof(uint16_t));
+    if(span > 0 && sums == NULL){
+      return WORKER_FAILED;
+    }
+    int summed = -1;
+
+    for(int j = band->start; j < band->end; j++){
+      // boundary rows of the parent keep their values
+      int parent_y = view->y + j;
+      if(parent_y == 0 || parent_y == parent->height - 1){
+        continue;
+      }
+
+      // sum the original rows not already summed, before any is overwritten
+      int next = summed + 1 > parent_y - 1 ? summed + 1 : parent_y - 1;
+      for(int y = next; y <= parent_y + 1; y++){
+        kernels->sums(original_row(band, y - view->y) + start, 
+                      sums + (size_t) (y % 3) * span, span, bpp);
+      }
+      summed = parent_y + 1;
+
+      const uint16_t *above = sums + (size_t) ((parent_y - 1) % 3) * span;
+      const uint16_t *middle = sums + (size_t) (parent_y % 3) * span;
+      const uint16_t *below = sums + (size_t) ((parent_y + 1) % 3) * span;
+      kernels->averages(above, middle, below, view_row(view, j) + start, 
+                        span);
+    }
+    free(sums);
+    return NULL;
+  }
+
+  // the in-place blurs match box_blur_picture and box_blur_view, but need 
+  // no second picture: only three rows of sums per band, and a copy of the
+  // original row either side of each band boundary (running out of memory 
+  // part way leaves the picture partly blurred, so that aborts as well)
+  void inplace_blur_picture(struct picture *pic){
+    struct picture_view view;
+    if(!init_full_view(&view, pic)){
+      out_of_memory();
+    }
+    inplace_blur_view(&view);
+  }
+
+  void inplace_blur_view(struct picture_view *view){
+    if(!view_make_writable(view)){
+      out_of_memory();
+    }
+
+    // split the rows into bands, saving the original row either side of 
+    // each band boundary (on a failed allocation, use a single band)
+    int bands = band_count(view->height);
+    struct band_work_args args[bands];
+    bool saved = true;
+    for(int b = 0; b < bands; b++){
+      args[b].sat = NULL;
+      args[b].kernel = NULL;
+      args[b].src = view;
+      args[b].dst = view;
+      args[b].radius = BOUNDARY_WIDTH;
+      args[b].start = (int) ((long) view->height * b / bands);
+      args[b].end = (int) ((long) view->height * (b + 1) / bands);
+      args[b].halo[0] = b > 0 ? save_view_row(view, args[b].start - 1) : NULL;
+      args[b].halo[1] = b < bands - 1 ? save_view_row(view, args[b].end) 
+                                      : NULL;
+      saved = saved && (b == 0 || args[b].halo[0] != NULL) && 
+              (b == bands - 1 || args[b].halo[1] != NULL);
+    }
+    if(!saved){
+      for(int b = 0; b < bands; b++){
+        free(args[b].halo[0]);
+        free(args[b].halo[1]);
+      }
+      args[0].end = view->height;
+      args[0].halo[0] = NULL;
+      args[0].halo[1] = NULL;
+      bands = 1;
+    }
+    bool done = run_bands(inplace_blur_worker, args, bands);
+    for(int b = 0; b < bands; b++){
+      free(args[b].halo[0]);
+      free(args[b].halo[1]);
+    }
+    if(!done){
+      out_of_memory();
+    }
+  }
+
+  // apply the kernel's row weights to the n pixels of row starting at in,
+  // storing the sums of each channel in out
+  static void convolve_row(const uint8_t *in, int32_t *out, int n, int bpp, 
+                           int channels, 
+                           const struct convolution_kernel *kernel){
+    int taps = 2 * kernel->radius + 1;
+    for(int i = 0; i < n; i++){
+      const uint8_t *window = in + (ptrdiff_t) (i - kernel->radius) * bpp;
+      for(int c = 0; c < channels; c++){
+        int32_t sum = 0;
+        for(int t = 0; t < taps; t++){
+          sum += kernel->row[t] * window[t * bpp + c];
+        }
+        out[i * channels + c] = sum;
+      }
+    }
+  }
+
+  // scale a weighted sum of samples back to a sample
+  static uint8_t scale_sum(int64_t sum, 
+                           const struct convolution_kernel *kernel){
+    sum += kernel->bias;
+    sum = kernel->shift >= 0 ? sum >> kernel->shift : sum / kernel->divisor;
+    return sum < 0 ? 0 : (sum > MAX_PIXEL_INTENSITY ? MAX_PIXEL_INTENSITY 
+                                                     : sum);
+  }
+
+  // convolve the band's rows of src into dst
+  static void *convolve_worker(void *args){
+    struct band_work_args *band = args;
+    const struct convolution_kernel *kernel = band->kernel;
+    struct picture_view *src = band->src;
+    struct picture *parent = src->parent;
+    int bpp = parent->bpp;
+    int channels = picture_channels(parent);
+    int radius = kernel->radius;
+    int taps = 2 * radius + 1;
+    size_t row_bytes = (size_t) src->width * bpp;
+
+    // region columns that lie at least radius pixels inside the parent
+    int first = radius - src->x;
+    int last = parent->width - radius - src->x;
+    if(first < 0) first = 0;
+    if(first > src->width) first = src->width;
+    if(last > src->width) last = src->width;
+    if(last < first) last = first;
+    size_t span = (size_t) (last - first) * channels;
+
+    // row sums of the last taps parent rows, indexed by row mod taps
+    int32_t *sums = NULL;
+    if(kernel->separable){
+      sums = malloc(taps * span * sizeof(int32_t));
+      if(span > 0 && sums == NULL){
+        return WORKER_FAILED;
+      }
+    }
+    int summed = -1;
+
+    for(int j = band->start; j < band->end; j++){
+      const uint8_t *row = view_row(src, j);
+      uint8_t *out = view_row(band->dst, j);
+
+      // don't need to modify the parent's boundary rows
+      int parent_y = src->y + j;
+      if(parent_y < radius || parent_y >= parent->height - radius){
+        memcpy(out, row, row_bytes);
+        continue;
+      }
+
+      // or its boundary pixels at either end of the row
+      memcpy(out, row, (size_t) first * bpp);
+      memcpy(out + (size_t) last * bpp, row + (size_t) last * bpp, 
+             row_bytes - (size_t) last * bpp);
+
+      if(kernel->separable){
+        // filter each row of the window not already filtered
+        int next = summed + 1 > parent_y - radius ? summed + 1 
+                                                  : parent_y - radius;
+        for(int y = next; y <= parent_y + radius; y++){
+          const uint8_t *in = row + (y - parent_y) * (ptrdiff_t) src->stride;
+          convolve_row(in + (size_t) first * bpp, 
+                       sums + (size_t) (y % taps) * span, last - first, bpp, 
+                       channels, kernel);
+        }
+        summed = parent_y + radius;
+
+        // then apply the column weights down the window
+        const int32_t *window[taps];
+        for(int t = 0; t < taps; t++){
+          window[t] = sums + (size_t) ((parent_y - radius + t) % taps) * span;
+        }
+        for(int i = first; i < last; i++){
+          for(int c = 0; c < channels; c++){
+            size_t k = (size_t) (i - first) * channels + c;
+            int64_t sum = 0;
+            for(int t = 0; t < taps; t++){
+              sum += (int64_t) kernel->column[t] * window[t][k];
+            }
+            out[i * bpp + c] = scale_sum(sum, kernel);
+          }
+        }
+      } else {
+        // weight the whole window around each pixel
+        for(int i = first; i < last; i++){
+          for(int c = 0; c < channels; c++){
+            int64_t sum = 0;
+            const int32_t *weight = kernel->weights;
+            for(int dy = -radius; dy <= radius; dy++){
+              const uint8_t *in = row + dy * (ptrdiff_t) src->stride + 
+                                  (ptrdiff_t) (i - radius) * bpp + c;
+              for(int t = 0; t < taps; t++){
+                sum += (int64_t) *weight++ * in[t * bpp];
+              }
+            }
+            out[i * bpp + c] = scale_sum(sum, kernel);
+          }
+        }
+      }
+    }
+    free(sums);
+    return NULL;
+  }
+
+  // Border maps: the parent coordinate a convolution reads for each 
+  // position v along n pixels, from -radius to n + radius - 1, with the 
+  // missing neighbours outside the parent taken as the border mode says.
+  // Mirroring reflects off both edges as often as it takes (the edge 
+  // pixels are not repeated, so the reflections repeat every 2(n - 1) 
+  // pixels), so a radius wider than the parent still mirrors.
+  #define CLAMP_COORD(v, n) ((v) < 0 ? 0 : ((v) >= (n) ? (n) - 1 : (v)))
+  #define WRAP_COORD(v, n) ((((v) % (n)) + (n)) % (n))
+  #define FOLD_COORD(m, n) ((m) < (n) ? (m) : 2 * ((n) - 1) - (m))
+  #define MIRROR_COORD(v, n) \
+    ((n) == 1 ? 0 : FOLD_COORD(WRAP_COORD(v, 2 * ((n) - 1)), n))
+
+  // one border worker serves every mode by reading through these maps, 
+  // rather than a worker generated per mode: the maps cost a lookup per 
+  // tap, but only border pixels ever read them
+  static void init_border_map(int *map, int n, int radius, 
+                              enum border_mode border){
+    for(int v = -radius; v < n + radius; v++){
+      map[v + radius] = border == BORDER_CLAMP ? CLAMP_COORD(v, n) :
+                        border == BORDER_MIRROR ? MIRROR_COORD(v, n) :
+                        WRAP_COORD(v, n);
+    }
+  }
+
+  // the region columns [*first, *last) that lie at least radius pixels 
+  // inside the parent
+  static void interior_columns(struct picture_view *src, int radius, 
+                               int *first, int *last){
+    *first = radius - src->x;
+    *last = src->parent->width - radius - src->x;
+    if(*first < 0) *first = 0;
+    if(*first > src->width) *first = src->width;
+    if(*last > src->width) *last = src->width;
+    if(*last < *first) *last = *first;
+  }
+
+  // number of region row j's pixels within radius of the parent's edge
+  static int border_pixels(struct picture_view *src, int radius, int j){
+    int y = src->y + j;
+    if(y < radius || y >= src->parent->height - radius){
+      return src->width;
+    }
+    int first, last;
+    interior_columns(src, radius, &first, &last);
+    return src->width - (last - first);
+  }
+
+  // sum the kernel's weights over the mapped window around region column i
+  // and parent row y (for kernels that do not factor into rows and columns)
+  static void border_window(struct band_work_args *band, int i, int y, 
+                            int channels, int64_t *sums){
+    const struct convolution_kernel *kernel = band->kernel;
+    struct picture *parent = band->src->parent;
+    int taps = 2 * kernel->radius + 1;
+    const int *columns = band->column_map + band->src->x + i;
+    const int32_t *weight = kernel->weights;
+    for(int c = 0; c < channels; c++){
+      sums[c] = 0;
+    }
+    for(int t = 0; t < taps; t++){
+      const uint8_t *row = picture_row(parent, band->row_map[y + t]);
+      for(int u = 0; u < taps; u++, weight++){
+        const uint8_t *in = row + (size_t) columns[u] * parent->bpp;
+        for(int c = 0; c < channels; c++){
+          sums[c] += (int64_t) *weight * in[c];
+        }
+      }
+    }
+  }
+
+  // convolve the pixels of the band's rows of src within the kernel's 
+  // radius of the parent's edge into dst, reading through the band's 
+  // border maps. Separable kernels filter each mapped source row once 
+  // across the pixels it is needed for, in a ring of the last taps rows, 
+  // then apply the column weights down the ring, as convolve_worker does.
+  static void *border_worker(void *args){
+    struct band_work_args *band = args;
+    const struct convolution_kernel *kernel = band->kernel;
+    struct picture_view *src = band->src;
+    struct picture *parent = src->parent;
+    int bpp = parent->bpp;
+    int channels = picture_channels(parent);
+    int radius = kernel->radius;
+    int taps = 2 * radius + 1;
+    int first, last;
+    interior_columns(src, radius, &first, &last);
+
+    // row sums of the last taps source rows, indexed by row mod taps, 
+    // and whether each was filtered across the whole row or only its ends
+    size_t span = (size_t) src->width * channels;
+    int32_t *ring = NULL;
+    int ring_row[taps];
+    bool ring_whole[taps];
+    if(kernel->separable){
+      ring = malloc(taps * span * sizeof(int32_t));
+      if(ring == NULL){
+        return WORKER_FAILED;
+      }
+      for(int t = 0; t < taps; t++){
+        ring_row[t] = INT_MIN;
+      }
+    }
+
+    for(int j = band->start; j < band->end; j++){
+      int y = src->y + j;
+      bool whole = y < radius || y >= parent->height - radius;
+      if(!whole && first == 0 && last == src->width){
+        continue;
+      }
+      uint8_t *out = view_row(band->dst, j);
+      // the row's border pixels: all of them, or those at either end
+      int ends[2][2] = {{0, whole ? src->width : first}, 
+                        {whole ? src->width : last, src->width}};
+
+      if(!kernel->separable){
+        int64_t sums[channels];
+        for(int e = 0; e < 2; e++){
+          for(int i = ends[e][0]; i < ends[e][1]; i++){
+            border_window(band, i, y, channels, sums);
+            for(int c = 0; c < channels; c++){
+              out[i * bpp + c] = scale_sum(sums[c], kernel);
+            }
+          }
+        }
+        continue;
+      }
+
+      // filter each source row of the window not already in the ring
+      const int32_t *window[taps];
+      for(int t = 0; t < taps; t++){
+        int v = y - radius + t;
+        int slot = ((v % taps) + taps) % taps;
+        int32_t *sums = ring + (size_t) slot * span;
+        window[t] = sums;
+        if(ring_row[slot] == v && (ring_whole[slot] || !whole)){
+          continue;
+        }
+        const uint8_t *row = picture_row(parent, band->row_map[v + radius]);
+        for(int e = 0; e < 2; e++){
+          for(int i = ends[e][0]; i < ends[e][1]; i++){
+            const int *columns = band->column_map + src->x + i;
+            for(int c = 0; c < channels; c++){
+              int32_t sum = 0;
+              for(int u = 0; u < taps; u++){
+                sum += kernel->row[u] * row[(size_t) columns[u] * bpp + c];
+              }
+              sums[i * channels + c] = sum;
+            }
+          }
+        }
+        ring_row[slot] = v;
+        ring_whole[slot] = whole;
+      }
+
+      // then apply the column weights down the window
+      for(int e = 0; e < 2; e++){
+        for(int i = ends[e][0]; i < ends[e][1]; i++){
+          for(int c = 0; c < channels; c++){
+            size_t k = (size_t) i * channels + c;
+            int64_t sum = 0;
+            for(int t = 0; t < taps; t++){
+              sum += (int64_t) kernel->column[t] * window[t][k];
+            }
+            out[i * bpp + c] = scale_sum(sum, kernel);
+          }
+        }
+      }
+    }
+    free(ring);
+    return NULL;
+  }
+
+  // convolve the pixels of src within the kernel's radius of the parent's
+  // edge into dst as the border mode says, in row bands of about equal 
+  // numbers of border pixels (returning false if it ran out of memory)
+  static bool convolve_border(struct picture_view *src, 
+                              struct picture_view *dst,
+                              const struct convolution_kernel *kernel, 
+                              enum border_mode border){
+    struct picture *parent = src->parent;
+    int radius = kernel->radius;
+    int *column_map = malloc((parent->width + 2 * radius) * sizeof(int));
+    int *row_map = malloc((parent->height + 2 * radius) * sizeof(int));
+    if(column_map == NULL || row_map == NULL){
+      free(column_map);
+      free(row_map);
+      return false;
+    }
+    init_border_map(column_map, parent->width, radius, border);
+    init_border_map(row_map, parent->height, radius, border);
+
+    int64_t total = 0;
+    for(int j = 0; j < src->height; j++){
+      total += border_pixels(src, radius, j);
+    }
+    int bands = band_count(src->height);
+    struct band_work_args args[bands];
+    int64_t done = 0;
+    int j = 0;
+    for(int b = 0; b < bands; b++){
+      args[b].sat = NULL;
+      args[b].kernel = kernel;
+      args[b].halo[0] = args[b].halo[1] = NULL;
+      args[b].src = src;
+      args[b].dst = dst;
+      args[b].radius = radius;
+      args[b].column_map = column_map;
+      args[b].row_map = row_map;
+      args[b].start = j;
+      while(j < src->height && done * bands < total * (b + 1)){
+        done += border_pixels(src, radius, j++);
+      }
+      args[b].end = b == bands - 1 ? src->height : j;
+    }
+    bool finished = run_bands(border_worker, args, bands);
+    free(column_map);
+    free(row_map);
+    return finished;
+  }
+
+  bool convolve_view_into(struct picture_view *src, struct picture_view *dst,
+                          const struct convolution_kernel *kernel,
+                          enum border_mode border){
+    // box kernels have faster exact algorithms of their own
+    bool done;
+    if(kernel->uniform && kernel->radius == BOUNDARY_WIDTH){
+      done = simd_blur_view_into(src, dst);
+    } else if(kernel->uniform){
+      done = integral_blur_view_into(src, dst, kernel->radius);
+    } else {
+      int bands = band_count(src->height);
+      struct band_work_args args[bands];
+      for(int b = 0; b < bands; b++){
+        args[b].sat = NULL;
+        args[b].kernel = kernel;
+        args[b].halo[0] = args[b].halo[1] = NULL;
+        args[b].src = src;
+        args[b].dst = dst;
+        args[b].radius = kernel->radius;
+        args[b].start = (int) ((long) src->height * b / bands);
+        args[b].end = (int) ((long) src->height * (b + 1) / bands);
+      }
+      done = run_bands(convolve_worker, args, bands);
+    }
+
+    // the interior kernels already copy border pixels through
+    return done && (border == BORDER_COPY || 
+                    convolve_border(src, dst, kernel, border));
+  }
+
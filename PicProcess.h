@@ -2,23 +2,136 @@
 #define PICLIB_H
 
 #include "Picture.h"
+#include "Kernel.h"
+#include "PointOps.h"
 #include "Utils.h"
 #include "myUtils.h"
   
+  // How convolutions treat pixels within the kernel's radius of the edge:
+  // copied through unchanged, or convolved with the missing neighbours 
+  // taken from the nearest edge pixel, the edge's mirror image, or the 
+  // opposite edge
+  enum border_mode {BORDER_COPY, BORDER_CLAMP, BORDER_MIRROR, BORDER_WRAP};
+
+  // How a warp reads pixels between the source's pixel centres: from the 
+  // nearest one, or blended from the four around
+  enum sample_mode {SAMPLE_NEAREST, SAMPLE_BILINEAR};
+
+  // An affine map of pixel coordinates (pixel centres at whole numbers), 
+  // taking (x, y) to (xx * x + xy * y + x0, yx * x + yy * y + y0)
+  struct affine_transform {
+    double xx, xy, x0;
+    double yx, yy, y0;
+  };
+
   // picture transformation routines
   void invert_picture(struct picture *pic);
   void grayscale_picture(struct picture *pic);
   void rotate_picture(struct picture *pic, int angle);
   void flip_picture(struct picture *pic, char plane);
   void blur_picture(struct picture *pic);
-  void parallel_blur_picture(struct picture *pic);
+  void box_blur_picture(struct picture *pic);
+  void simd_blur_picture(struct picture *pic);
+  void integral_blur_picture(struct picture *pic, int radius);
+  void fused_blur_picture(struct picture *pic, int passes);
+  void inplace_blur_picture(struct picture *pic);
+  void tiled_blur_picture(struct picture *pic, int threads);
+  void gaussian_blur_picture(struct picture *pic, double sigma);
+  void median_picture(struct picture *pic, int radius);
+  void convolve_picture(struct picture *pic, 
+                        const struct convolution_kernel *kernel,
+                        enum border_mode border);
+  void point_ops_picture(struct picture *pic, 
+                         const struct point_pipeline *pipeline);
 
-  struct p_work_args {
-    struct picture *orig_pic;
-    struct picture *new_pic;
-    int x_coord;
-    int y_coord;
-  };
+  // region-of-interest transformation routines (work in place on the 
+  // view's region of its parent picture)
+  void invert_view(struct picture_view *view);
+  void grayscale_view(struct picture_view *view);
+  void blur_view(struct picture_view *view);
+  void box_blur_view(struct picture_view *view);
+  void simd_blur_view(struct picture_view *view);
+  void integral_blur_view(struct picture_view *view, int radius);
+  void convolve_view(struct picture_view *view, 
+                     const struct convolution_kernel *kernel,
+                     enum border_mode border);
+  void fused_blur_view(struct picture_view *view, int passes);
+  void inplace_blur_view(struct picture_view *view);
+  void tiled_blur_view(struct picture_view *view, int threads);
+  void gaussian_blur_view(struct picture_view *view, double sigma);
+  void median_view(struct picture_view *view, int radius);
+  void point_ops_view(struct picture_view *view, 
+                      const struct point_pipeline *pipeline);
+
+  // blur the region of src into the same-sized dst, reading neighbours 
+  // outside src from its parent (parent boundary pixels are copied as-is)
+  void blur_view_into(struct picture_view *src, struct picture_view *dst);
+
+  // The blurs into a second view below return false if they run out of 
+  // memory, leaving dst only partly written.
+
+  // as blur_view_into, but with separable running sums: each row is summed
+  // horizontally once and the sums of three rows added for every output 
+  // row (bit-exact with blur_view_into)
+  bool box_blur_view_into(struct picture_view *src, struct picture_view *dst);
+
+  // as box_blur_view_into, with row kernels vectorised for the best 
+  // instruction set the CPU supports (AVX2, SSE4.1, or scalar otherwise)
+  bool simd_blur_view_into(struct picture_view *src, struct picture_view *dst);
+
+  // name of the instruction set simd_blur_view_into runs on
+  const char *simd_blur_isa(void);
+
+  // blur the region of src into dst, averaging each pixel over the 
+  // (2 * radius + 1) square around it from a 64-bit integral image, so the
+  // cost per pixel does not depend on the radius (pixels within radius of
+  // the parent's edge are copied as-is; radius 1 matches blur_view_into)
+  bool integral_blur_view_into(struct picture_view *src, 
+                               struct picture_view *dst, int radius);
+
+  // blur the region of src into dst as many times over as passes, tile by 
+  // tile: each tile is loaded with a halo as wide as passes and blurred 
+  // that many times while it is in cache, so the picture is streamed 
+  // through memory once (bit-exact with repeated box_blur_view_into)
+  bool fused_blur_view_into(struct picture_view *src, struct picture_view *dst,
+                            int passes);
+
+  // convolve the region of src with kernel into dst, row bands in parallel
+  // (separable kernels run as a row pass then a column pass, and box 
+  // kernels as box_blur_view_into or integral_blur_view_into; pixels within
+  // the kernel's radius of the parent's edge are then treated as border 
+  // says, in a separate pass); false if it ran out of memory
+  bool convolve_view_into(struct picture_view *src, struct picture_view *dst,
+                          const struct convolution_kernel *kernel,
+                          enum border_mode border);
+
+  // blur the region of src into dst in BLUR_TILE_SIZE square tiles, which
+  // the given number of threads (or one per core if less than 1) take in 
+  // turn as they finish their last (bit-exact with box_blur_view_into)
+  bool tiled_blur_view_into(struct picture_view *src, struct picture_view *dst,
+                            int threads);
+
+  // replace each pixel of the region of src, in dst, with the per-channel 
+  // median of the (2 * radius + 1) square around it, in tiles on one 
+  // thread per core, at a cost per pixel independent of the radius 
+  // (pixels within radius of the parent's edge are copied as-is)
+  bool median_view_into(struct picture_view *src, struct picture_view *dst,
+                        int radius);
+
+  // move each pixel of pic to where transform takes it, keeping pic's size
+  // (output pixels from outside the source are black): the source is 
+  // stepped through in fixed point along each output row, rows in parallel
+  // and colour bilinear samples blended with SSSE3 where the CPU supports 
+  // it (nearest and gray sampling are scalar)
+  void warp_picture(struct picture *pic, 
+                    const struct affine_transform *transform, 
+                    enum sample_mode sampling);
+
+  // rotate pic clockwise by any angle about its centre: whole quarter turns
+  // are only reoriented (so a non-square picture swaps its width and 
+  // height), other angles are warped within pic's size, cropping corners
+  void rotate_picture_by(struct picture *pic, double degrees, 
+                         enum sample_mode sampling);
 
 #endif
 
@@ -1,56 +1,481 @@
 #include "Picture.h"
+#include "Orientation.h"
+#include <string.h>
+
+  #define NO_RGB_COMPONENTS 3
+
+  // take a pooled buffer for a width x height linear picture, holding one 
+  // reference
+  static struct pixel_buffer *create_buffer(int width, int height, int bpp,
+                                            bool zeroed){
+    struct pixel_buffer *buffer = malloc(sizeof(struct pixel_buffer));
+    if(buffer == NULL){
+      return NULL;
+    }
+    buffer->data = acquire_pixel_buffer(width, height, bpp, zeroed);
+    if(buffer->data == NULL){
+      free(buffer);
+      return NULL;
+    }
+    buffer->size = padded_stride((size_t) width * bpp) * height;
+    buffer->width = width;
+    buffer->height = height;
+    buffer->bpp = bpp;
+    atomic_init(&buffer->refs, 1);
+    return buffer;
+  }
+
+  // drop a reference, returning the buffer to the pool with the last one
+  static void release_buffer(struct pixel_buffer *buffer){
+    if(atomic_fetch_sub(&buffer->refs, 1) == 1){
+      release_pixel_buffer(buffer->data, buffer->width, buffer->height, 
+                           buffer->bpp);
+      free(buffer);
+    }
+  }
 
   bool init_picture_from_file(struct picture *pic, const char *path){
-    pic->img = load_image(path);
+    sod_img img = load_image(path);
     // check for picture initialisation error
-    if( pic->img.data == 0 ){
+    if( img.data == 0 ){
       return false;
     }    
-    pic->width = get_image_width(pic->img);
-    pic->height = get_image_height(pic->img);
-    return true;
+    // single-channel files stay single-channel
+    int bpp = img.c < NO_RGB_COMPONENTS ? PICTURE_GRAY_BPP : 
+                                          PICTURE_DEFAULT_BPP;
+    if(!init_picture_with_format(pic, get_image_width(img), 
+                                 get_image_height(img), bpp)){
+      free_image(img);
+      return false;
+    }
+    // unpack the decoded planar float image into packed bytes
+    image_to_pixels(img, pic->pixels, picture_stride(pic), pic->bpp);
+    free_image(img);
+    return picture_set_layout(pic, PICTURE_DEFAULT_LAYOUT);
   }
 
   bool init_picture_from_size(struct picture *pic, int width, int height){
-    pic->img = create_image(width, height);
+    return init_picture_with_format(pic, width, height, PICTURE_DEFAULT_BPP);
+  }
+
+  // number of tiles needed to cover n pixels
+  static int tile_count(int n){
+    return (n + PICTURE_TILE_SIZE - 1) / PICTURE_TILE_SIZE;
+  }
+
+  // initialise pic's fields around a new buffer
+  static bool init_picture_buffer(struct picture *pic, int width, int height,
+                                  int bpp, enum picture_layout layout, 
+                                  bool zeroed){
+    if(layout == PICTURE_TILED){
+      // tiles are stored one after another, so a tiled picture takes the 
+      // buffer of a linear picture made of whole tiles
+      pic->tiles_across = tile_count(width);
+      pic->stride = (size_t) PICTURE_TILE_SIZE * bpp;
+      pic->buffer = create_buffer(pic->tiles_across * PICTURE_TILE_SIZE, 
+                                  tile_count(height) * PICTURE_TILE_SIZE, 
+                                  bpp, zeroed);
+    } else {
+      pic->tiles_across = 0;
+      pic->stride = padded_stride((size_t) width * bpp);
+      pic->buffer = create_buffer(width, height, bpp, zeroed);
+    }
     // check for picture initialisation error
-    if ( pic->img.data == 0 ){
+    if ( pic->buffer == NULL ){
       return false;
     }
+    pic->pixels = pic->buffer->data;
     pic->width = width;
     pic->height = height;
+    pic->bpp = bpp;
+    pic->layout = layout;
+    pic->orientation = ORIENT_UPRIGHT;
+    return true;
+  }
+
+  bool init_picture_with_format(struct picture *pic, int width, int height,
+                                int bpp){
+    return init_picture_buffer(pic, width, height, bpp, PICTURE_LINEAR, true);
+  }
+
+  bool init_picture_for_overwrite(struct picture *pic, int width, int height,
+                                  int bpp){
+    return init_picture_buffer(pic, width, height, bpp, PICTURE_LINEAR, 
+                               false);
+  }
+
+  bool init_picture_like(struct picture *pic, struct picture *src, 
+                         int width, int height){
+    return init_picture_buffer(pic, width, height, src->bpp, src->layout, 
+                               false);
+  }
+
+  bool copy_picture(struct picture *pic, struct picture *src){
+    atomic_fetch_add(&src->buffer->refs, 1);
+    overwrite_picture(pic, src);
+    return true;
+  }
+
+  bool picture_make_writable(struct picture *pic){
+    if(!picture_apply_orientation(pic)){
+      return false;
+    }
+    struct pixel_buffer *shared = pic->buffer;
+    if(atomic_load(&shared->refs) == 1){
+      return true;
+    }
+    // first write to a shared buffer: clone it
+    struct pixel_buffer *own = create_buffer(shared->width, shared->height, 
+                                             shared->bpp, false);
+    if(own == NULL){
+      return false;
+    }
+    memcpy(own->data, shared->data, shared->size);
+    release_buffer(shared);
+    pic->buffer = own;
+    pic->pixels = own->data;
     return true;
   }
   
   void overwrite_picture(struct picture *pic1, struct picture *pic2){
-    pic1->img = pic2->img;
+    pic1->buffer = pic2->buffer;
+    pic1->pixels = pic2->pixels;
     pic1->width = pic2->width;
     pic1->height = pic2->height;
+    pic1->bpp = pic2->bpp;
+    pic1->stride = pic2->stride;
+    pic1->layout = pic2->layout;
+    pic1->tiles_across = pic2->tiles_across;
+    pic1->orientation = pic2->orientation;
+  }
+
+  int picture_channels(struct picture *pic){
+    return pic->bpp == PICTURE_GRAY_BPP ? 1 : NO_RGB_COMPONENTS;
+  }
+
+  bool picture_make_colour(struct picture *pic){
+    if(pic->bpp != PICTURE_GRAY_BPP){
+      return true;
+    }
+    if(!picture_apply_orientation(pic)){
+      return false;
+    }
+    struct picture tmp;
+    if(!init_picture_buffer(&tmp, pic->width, pic->height, 
+                            PICTURE_DEFAULT_BPP, pic->layout, false)){
+      return false;
+    }
+    // copy each gray sample into all three colour samples
+    for(int y = 0; y < pic->height; y++){
+      for(int x = 0; x < pic->width; x++){
+        memset(picture_pixel(&tmp, x, y), *picture_pixel(pic, x, y), 
+               NO_RGB_COMPONENTS);
+      }
+    }
+    clear_picture(pic);
+    overwrite_picture(pic, &tmp);
+    return true;
+  }
+
+  bool picture_set_layout(struct picture *pic, enum picture_layout layout){
+    if(!picture_apply_orientation(pic)){
+      return false;
+    }
+    if(pic->layout == layout){
+      return true;
+    }
+    struct picture tmp;
+    if(!init_picture_buffer(&tmp, pic->width, pic->height, pic->bpp, layout, 
+                            false)){
+      return false;
+    }
+    // copy across each run of pixels that is contiguous in both layouts
+    for(int y = 0; y < pic->height; y++){
+      for(int x = 0; x < pic->width; ){
+        int run = picture_run_length(pic, x);
+        int tmp_run = picture_run_length(&tmp, x);
+        if(tmp_run < run){
+          run = tmp_run;
+        }
+        memcpy(picture_pixel(&tmp, x, y), picture_pixel(pic, x, y), 
+               (size_t) run * pic->bpp);
+        x += run;
+      }
+    }
+    clear_picture(pic);
+    overwrite_picture(pic, &tmp);
+    return true;
+  }
+
+  enum picture_orientation compose_orientations(
+      enum picture_orientation first, enum picture_orientation then){
+    // a flip reverses the direction of the turns made before it
+    int turns = (then & ORIENT_FLIP_H) ? (then & ORIENT_ROTATE_270) - first 
+                                       : (then & ORIENT_ROTATE_270) + first;
+    return ((first ^ then) & ORIENT_FLIP_H) | (turns & ORIENT_ROTATE_270);
+  }
+
+  bool orientation_swaps_axes(enum picture_orientation orientation){
+    return (orientation & ORIENT_ROTATE_90) != 0;
+  }
+
+  // exchange pic's width and height
+  static void swap_axes(struct picture *pic){
+    int width = pic->width;
+    pic->width = pic->height;
+    pic->height = width;
+  }
+
+  void picture_orient(struct picture *pic, 
+                      enum picture_orientation orientation){
+    pic->orientation = compose_orientations(pic->orientation, orientation);
+    if(orientation_swaps_axes(orientation)){
+      swap_axes(pic);
+    }
+  }
+
+  bool picture_apply_orientation(struct picture *pic){
+    enum picture_orientation orientation = pic->orientation;
+    if(orientation == ORIENT_UPRIGHT){
+      return true;
+    }
+    // back to the stored picture, upright (as moving its pixels makes it 
+    // writable, which applies its orientation)
+    if(orientation_swaps_axes(orientation)){
+      swap_axes(pic);
+    }
+    pic->orientation = ORIENT_UPRIGHT;
+    if(!reorient_pixels(pic, orientation)){
+      picture_orient(pic, orientation);
+      return false;
+    }
+    return true;
   }
 
   bool save_picture_to_file(struct picture *pic, const char *path){
-    return save_image(pic->img, path);   
+    // move any rotated or flipped pixels into place once, in pic itself
+    if(!picture_apply_orientation(pic)){
+      printf("[!] error saving file to %s\n", path);
+      return false;
+    }
+
+    // the encoder reads whole rows, so save tiled pictures from a linear copy
+    struct picture linear;
+    copy_picture(&linear, pic);
+    if(!picture_set_layout(&linear, PICTURE_LINEAR)){
+      printf("[!] error saving file to %s\n", path);
+      clear_picture(&linear);
+      return false;
+    }
+
+    bool saved = save_pixels(linear.pixels, picture_stride(&linear), 
+                             linear.bpp, linear.width, linear.height, path);
+    clear_picture(&linear);
+    return saved;
   }
 
   // enum mapping to support get/set pixel functions
   enum RGB {RED, GREEN, BLUE};
 
+  // offsets of the green and blue samples of a pixel (a grayscale pixel's 
+  // one sample stands for all three)
+  static inline int green_offset(struct picture *pic){
+    return pic->bpp == PICTURE_GRAY_BPP ? RED : GREEN;
+  }
+  static inline int blue_offset(struct picture *pic){
+    return pic->bpp == PICTURE_GRAY_BPP ? RED : BLUE;
+  }
+
+  // whether n pixels can be stored in pic without losing colour
+  static bool fits_format(struct picture *pic, int n, const struct pixel *in){
+    if(pic->bpp != PICTURE_GRAY_BPP){
+      return true;
+    }
+    for(int i = 0; i < n; i++){
+      if(in[i].red != in[i].green || in[i].red != in[i].blue){
+        return false;
+      }
+    }
+    return true;
+  }
+
+  uint8_t *picture_row(struct picture *pic, int y){
+    return pic->pixels + (size_t) y * picture_stride(pic);
+  }
+
+  size_t picture_stride(struct picture *pic){
+    return pic->stride;
+  }
+
+  int picture_line_pixels(struct picture *pic){
+    // CACHE_LINE_SIZE / gcd(CACHE_LINE_SIZE, bpp)
+    int a = CACHE_LINE_SIZE;
+    int b = pic->bpp;
+    while(b != 0){
+      int r = a % b;
+      a = b;
+      b = r;
+    }
+    return CACHE_LINE_SIZE / a;
+  }
+
+  // locate the first sample of the pixel at (x,y)
+  static inline uint8_t *pixel_address(struct picture *pic, int x, int y){
+    if(pic->layout == PICTURE_TILED){
+      size_t tile = (size_t) (y / PICTURE_TILE_SIZE) * pic->tiles_across 
+                  + x / PICTURE_TILE_SIZE;
+      return pic->pixels + tile * PICTURE_TILE_SIZE * pic->stride 
+             + (y % PICTURE_TILE_SIZE) * pic->stride 
+             + (x % PICTURE_TILE_SIZE) * pic->bpp;
+    }
+    return picture_row(pic, y) + (size_t) x * pic->bpp;
+  }
+
+  uint8_t *picture_pixel(struct picture *pic, int x, int y){
+    return pixel_address(pic, x, y);
+  }
+
+  int picture_run_length(struct picture *pic, int x){
+    if(pic->layout == PICTURE_TILED){
+      int end = (x / PICTURE_TILE_SIZE + 1) * PICTURE_TILE_SIZE;
+      return (end < pic->width ? end : pic->width) - x;
+    }
+    return pic->width - x;
+  }
+
+  // locate the first sample of the pixel at (x,y) of pic as it will be 
+  // once its pending orientation is applied, without moving any pixels
+  static uint8_t *oriented_address(struct picture *pic, int x, int y){
+    if(pic->orientation != ORIENT_UPRIGHT){
+      bool swapped = orientation_swaps_axes(pic->orientation);
+      orientation_source(pic->orientation, 
+                         swapped ? pic->height : pic->width, 
+                         swapped ? pic->width : pic->height, &x, &y);
+    }
+    return pixel_address(pic, x, y);
+  }
+
   struct pixel get_pixel(struct picture *pic, int x, int y){
     // Beware: pixels are stored in a (x,y) vector from the top left of the image.
     struct pixel pix;
+
+    // clamp to the nearest edge pixel (as SOD did for out of range reads)
+    if(x < 0) x = 0;
+    if(x >= pic->width) x = pic->width - 1;
+    if(y < 0) y = 0;
+    if(y >= pic->height) y = pic->height - 1;
     
-    pix.red = get_pixel_value(pic->img, RED, x, y);
-    pix.green = get_pixel_value(pic->img, GREEN, x, y);
-    pix.blue = get_pixel_value(pic->img, BLUE, x, y);
+    uint8_t *p = oriented_address(pic, x, y);
+    pix.red = p[RED];
+    pix.green = p[green_offset(pic)];
+    pix.blue = p[blue_offset(pic)];
     
     return pix;
   }
 
-  void set_pixel(struct picture *pic, int x, int y, struct pixel *rgb){
+  bool set_pixel(struct picture *pic, int x, int y, struct pixel *rgb){
     // Beware: pixels are stored in a (x,y) vector from the top left of the image.
-    set_pixel_value(pic->img, RED, x, y, rgb->red);
-    set_pixel_value(pic->img, GREEN, x, y, rgb->green);
-    set_pixel_value(pic->img, BLUE, x, y, rgb->blue);
+    if(!contains_point(pic, x, y)){
+      return false;
+    }
+    return set_pixels(pic, x, y, 1, rgb);
+  }
+
+  // number of pixels from x that can be accessed as one contiguous run, 
+  // capped at n
+  static inline int span_run(struct picture *pic, int x, int n){
+    if(pic->orientation != ORIENT_UPRIGHT){
+      return 1;
+    }
+    if(pic->layout != PICTURE_TILED){
+      return n;
+    }
+    int run = picture_run_length(pic, x);
+    return run < n ? run : n;
+  }
+
+  void get_pixels(struct picture *pic, int x, int y, int n, struct pixel *out){
+    int green = green_offset(pic);
+    int blue = blue_offset(pic);
+    while(n > 0){
+      int run = span_run(pic, x, n);
+      const uint8_t *p = oriented_address(pic, x, y);
+      for(int i = 0; i < run; i++, p += pic->bpp){
+        out[i].red = p[RED];
+        out[i].green = p[green];
+        out[i].blue = p[blue];
+      }
+      x += run;
+      out += run;
+      n -= run;
+    }
+  }
+
+  bool set_pixels(struct picture *pic, int x, int y, int n, 
+                  const struct pixel *in){
+    // the picture is never changed here, so a shared buffer or a gray 
+    // picture given colour pixels must be prepared by the caller
+    if(atomic_load(&pic->buffer->refs) != 1 || !fits_format(pic, n, in)){
+      return false;
+    }
+    int green = green_offset(pic);
+    int blue = blue_offset(pic);
+    while(n > 0){
+      int run = span_run(pic, x, n);
+      uint8_t *p = oriented_address(pic, x, y);
+      for(int i = 0; i < run; i++, p += pic->bpp){
+        p[RED] = in[i].red;
+        p[green] = in[i].green;
+        p[blue] = in[i].blue;
+      }
+      x += run;
+      in += run;
+      n -= run;
+    }
+    return true;
+  }
+
+  bool init_picture_view(struct picture_view *view, struct picture *pic, 
+                         int x, int y, int width, int height){
+    if(x < 0 || y < 0 || width < 0 || height < 0 || 
+       x + width > pic->width || y + height > pic->height ||
+       !picture_set_layout(pic, PICTURE_LINEAR)){
+      return false;
+    }
+    view->parent = pic;
+    view->x = x;
+    view->y = y;
+    view->width = width;
+    view->height = height;
+    view->pixels = pixel_address(pic, x, y);
+    view->stride = picture_stride(pic);
+    return true;
+  }
+
+  bool init_full_view(struct picture_view *view, struct picture *pic){
+    if(!picture_set_layout(pic, PICTURE_LINEAR)){
+      return false;
+    }
+    view->parent = pic;
+    view->x = 0;
+    view->y = 0;
+    view->width = pic->width;
+    view->height = pic->height;
+    view->pixels = pic->pixels;
+    view->stride = picture_stride(pic);
+    return true;
+  }
+
+  bool view_make_writable(struct picture_view *view){
+    if(!picture_make_writable(view->parent)){
+      return false;
+    }
+    view->pixels = pixel_address(view->parent, view->x, view->y);
+    return true;
+  }
+
+  uint8_t *view_row(struct picture_view *view, int y){
+    return view->pixels + (size_t) y * view->stride;
   }
 
   bool contains_point(struct picture *pic, int x, int y){
@@ -58,5 +483,5 @@
   }
   
   void clear_picture(struct picture *pic){
-    free_image(pic->img); 
+    release_buffer(pic->buffer); 
   }  
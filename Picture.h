@@ -3,6 +3,52 @@
 
 #include "Utils.h"
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+  // bytes per pixel of the supported packed storage formats (grayscale 
+  // pictures keep a single sample per pixel)
+  #define PICTURE_GRAY_BPP 1
+  #define PICTURE_RGB_BPP 3
+  #define PICTURE_RGBX_BPP 4
+
+  // storage format used for new pictures (override with -DPICTURE_DEFAULT_BPP=4)
+  #ifndef PICTURE_DEFAULT_BPP
+  #define PICTURE_DEFAULT_BPP PICTURE_RGB_BPP
+  #endif
+
+  // In-memory pixel layouts: whole rows one after another, or square tiles 
+  // of PICTURE_TILE_SIZE x PICTURE_TILE_SIZE pixels (each tile stored row 
+  // by row, tiles in row order) so that column walks stay cache-resident
+  enum picture_layout {PICTURE_LINEAR, PICTURE_TILED};
+
+  // tile edge length in pixels (a power of two, e.g. -DPICTURE_TILE_SIZE=64)
+  #ifndef PICTURE_TILE_SIZE
+  #define PICTURE_TILE_SIZE 32
+  #endif
+
+  // layout of loaded pictures (override with 
+  // -DPICTURE_DEFAULT_LAYOUT=PICTURE_TILED)
+  #ifndef PICTURE_DEFAULT_LAYOUT
+  #define PICTURE_DEFAULT_LAYOUT PICTURE_LINEAR
+  #endif
+
+  // The eight orientations of a picture's stored pixels relative to the 
+  // picture they stand for (the symmetries of a rectangle): a horizontal 
+  // flip or not (bit 2), followed by 0 to 3 clockwise quarter turns (the 
+  // low two bits)
+  enum picture_orientation {
+    ORIENT_UPRIGHT = 0,
+    ORIENT_ROTATE_90 = 1,
+    ORIENT_ROTATE_180 = 2,
+    ORIENT_ROTATE_270 = 3,
+    ORIENT_FLIP_H = 4,
+    // reflected in the anti-diagonal
+    ORIENT_TRANSVERSE = 5,
+    ORIENT_FLIP_V = 6,
+    // reflected in the main diagonal
+    ORIENT_TRANSPOSE = 7
+  };
 
   // The pixel struct is used to represent a pixel of an image in RGB format
   struct pixel {
@@ -11,32 +57,174 @@
     int blue;
   };
 
-  // The picture struct provides a wrapper for image manipulation 
-  // via the SOD library (https://sod.pixlab.io/intro.html)
+  // Reference-counted pixel storage, shared copy-on-write between pictures
+  struct pixel_buffer {
+    uint8_t *data;
+    size_t size;
+    // format of the linear picture the buffer was sized for
+    int width;
+    int height;
+    int bpp;
+    // number of pictures currently sharing the buffer
+    atomic_int refs;
+  };
+
+  // The picture struct stores an image as packed 8-bit interleaved RGB (or 
+  // RGBX) samples. The SOD library (https://sod.pixlab.io/intro.html) is 
+  // only used to decode and encode image files on load and save.
   struct picture {    
-    // sod representation of an image
-    sod_img img;
+    // storage shared with any copies of this picture
+    struct pixel_buffer *buffer;
+    // pixel samples, row by row from the top left of the image (each row 
+    // starts on a cache line boundary)
+    uint8_t *pixels;
     int width;
     int height;
+    // bytes per pixel (PICTURE_GRAY_BPP, PICTURE_RGB_BPP or PICTURE_RGBX_BPP)
+    int bpp;
+    // bytes between the start of consecutive rows (padded to whole lines),
+    // or between consecutive rows of a tile in the tiled layout
+    size_t stride;
+    enum picture_layout layout;
+    // number of tiles in each row of tiles (tiled layout only)
+    int tiles_across;
+    // rotation or flip still to be applied to the stored pixels (width and
+    // height are those of the picture once it has been)
+    enum picture_orientation orientation;
   };    
+
+  // The picture_view struct references a rectangular region of a parent 
+  // picture's pixels in place (no pixels are copied)
+  struct picture_view {
+    struct picture *parent;
+    // offset of the region's top-left pixel within the parent picture
+    int x;
+    int y;
+    int width;
+    int height;
+    // first sample of the region's top-left pixel and bytes between its rows
+    uint8_t *pixels;
+    size_t stride;
+  };
       
   // initialise picture struct with image from a provided file
   bool init_picture_from_file(struct picture *pic, const char *path);
 
   // initialise picture struct of the specified size 
   bool init_picture_from_size(struct picture *pic, int width, int height); 
+
+  // initialise picture struct of the specified size and storage format
+  bool init_picture_with_format(struct picture *pic, int width, int height,
+                                int bpp);
+
+  // initialise picture struct of the specified size and storage format 
+  // without clearing its pixels (for outputs that write every pixel)
+  bool init_picture_for_overwrite(struct picture *pic, int width, int height,
+                                  int bpp);
+
+  // initialise picture struct of the specified size in the storage format 
+  // and layout of src, without clearing its pixels
+  bool init_picture_like(struct picture *pic, struct picture *src, 
+                         int width, int height);
+
+  // initialise picture struct as a copy of src (the pixels are shared 
+  // until either picture is written to, so this is O(1))
+  bool copy_picture(struct picture *pic, struct picture *src);
+
+  // give pic sole ownership of its pixels, cloning them if they are shared
+  // (required before writing through picture_row/view_row pointers)
+  bool picture_make_writable(struct picture *pic);
   
   // overwrites the stored image in pic1 with the stored image in pic2
   void overwrite_picture(struct picture *pic1, struct picture *pic2);
 
+  // number of colour samples stored per pixel (1 for grayscale pictures, 
+  // whose pixels read back with equal red, green and blue values)
+  int picture_channels(struct picture *pic);
+
+  // store a grayscale picture with PICTURE_DEFAULT_BPP colour samples per 
+  // pixel (colour pictures are left as they are)
+  bool picture_make_colour(struct picture *pic);
+
+  // rearrange the pixels of pic into the given layout
+  bool picture_set_layout(struct picture *pic, enum picture_layout layout);
+
+  // the orientation reached by applying first and then then
+  enum picture_orientation compose_orientations(
+    enum picture_orientation first, enum picture_orientation then);
+
+  // whether an orientation exchanges a picture's width and height
+  bool orientation_swaps_axes(enum picture_orientation orientation);
+
+  // rotate or flip pic lazily: the change is composed with any pending one
+  // and the pixels are only moved, in a single pass, once they are next 
+  // accessed through a view, picture_make_writable, a layout change or a 
+  // save (get/set_pixel(s) read and write through it instead)
+  void picture_orient(struct picture *pic, 
+                      enum picture_orientation orientation);
+
+  // move pic's stored pixels into their pending orientation
+  bool picture_apply_orientation(struct picture *pic);
+
   // save picture to specified file
   bool save_picture_to_file(struct picture *pic, const char *path);
 
+  // Per-pixel access, free of side effects so workers can share a picture:
+  // pixels are read and written where any pending orientation puts them, 
+  // without moving the rest. Writes are refused (returning false) while 
+  // the buffer is shared or a colour pixel is given to a grayscale 
+  // picture, so call picture_make_writable, and picture_make_colour if 
+  // need be, before writing.
+
   // extract a single pixel from the image as a colour struct
+  // (out of range coordinates are clamped to the nearest edge pixel)
   struct pixel get_pixel(struct picture *pic, int x, int y);
 
   // set a single pixel in the image from a colour struct
-  void set_pixel(struct picture *pic, int x, int y, struct pixel *rgb);
+  // (out of range coordinates are ignored)
+  bool set_pixel(struct picture *pic, int x, int y, struct pixel *rgb);
+
+  // Layout-agnostic access: the pixel at (x,y) starts at 
+  // picture_pixel(pic, x, y), and picture_run_length(pic, x) pixels from 
+  // there along the row are stored contiguously, bpp bytes per pixel. 
+  // Not bounds checked; write only after picture_make_writable. These 
+  // read the pixels as stored, so apply any pending orientation first.
+  uint8_t *picture_pixel(struct picture *pic, int x, int y);
+  int picture_run_length(struct picture *pic, int x);
+
+  // Row-span access (linear layout only): pixel samples of row y are stored
+  // contiguously from picture_row(pic, y), bpp bytes per pixel, with 
+  // consecutive rows picture_stride(pic) bytes apart. Spans are not bounds 
+  // checked, and may only be written to after picture_make_writable (as 
+  // above, any pending orientation must be applied first).
+  uint8_t *picture_row(struct picture *pic, int y);
+  size_t picture_stride(struct picture *pic);
+
+  // smallest number of pixels that fills a whole number of cache lines 
+  // (ranges of rows split at multiples of this never share a cache line)
+  int picture_line_pixels(struct picture *pic);
+
+  // extract n consecutive pixels of row y, starting at x, into out
+  void get_pixels(struct picture *pic, int x, int y, int n, struct pixel *out);
+
+  // set n consecutive pixels of row y, starting at x, from in
+  bool set_pixels(struct picture *pic, int x, int y, int n, 
+                  const struct pixel *in);
+
+  // initialise a view of the width x height region of pic whose top-left 
+  // pixel is (x,y) (fails unless the region lies within the picture)
+  // Views address rows, so a tiled pic is switched to the linear layout.
+  bool init_picture_view(struct picture_view *view, struct picture *pic, 
+                         int x, int y, int width, int height);
+
+  // initialise a view covering the whole of pic (as above)
+  bool init_full_view(struct picture_view *view, struct picture *pic);
+
+  // make the view's parent writable and refresh the view's pixel pointer
+  bool view_make_writable(struct picture_view *view);
+
+  // first sample of row y of the view (not bounds checked)
+  uint8_t *view_row(struct picture_view *view, int y);
 
   // check if coordinates are within bounds of the stored image
   bool contains_point(struct picture *pic, int x, int y);
@@ -0,0 +1,97 @@
+#include "PointOps.h"
+#include <string.h>
+
+  // The operations a pipeline spec may name
+  struct point_op {
+    const char *name;
+    void (*add)(struct point_pipeline *);
+  };
+
+  static const struct point_op point_ops[] = {
+    {"invert", add_point_invert},
+    {"grayscale", add_point_grayscale}
+  };
+
+  static const int no_of_point_ops = sizeof(point_ops) / sizeof(point_ops[0]);
+
+  void init_point_pipeline(struct point_pipeline *pipeline){
+    for(int c = 0; c < POINT_CHANNELS; c++){
+      for(int v = 0; v < 256; v++){
+        pipeline->channel[c][v] = v;
+      }
+    }
+    pipeline->mixed = false;
+  }
+
+  void add_point_tables(struct point_pipeline *pipeline, 
+                        const uint8_t tables[POINT_CHANNELS][256]){
+    // once channels are mixed the tables apply to the mix
+    for(int c = 0; c < POINT_CHANNELS; c++){
+      if(pipeline->mixed){
+        for(int s = 0; s <= POINT_SUM_MAX; s++){
+          pipeline->sum[c][s] = tables[c][pipeline->sum[c][s]];
+        }
+      } else {
+        for(int v = 0; v < 256; v++){
+          pipeline->channel[c][v] = tables[c][pipeline->channel[c][v]];
+        }
+      }
+    }
+  }
+
+  void add_point_invert(struct point_pipeline *pipeline){
+    uint8_t tables[POINT_CHANNELS][256];
+    for(int c = 0; c < POINT_CHANNELS; c++){
+      for(int v = 0; v < 256; v++){
+        tables[c][v] = MAX_PIXEL_INTENSITY - v;
+      }
+    }
+    add_point_tables(pipeline, tables);
+  }
+
+  void add_point_grayscale(struct point_pipeline *pipeline){
+    for(int s = 0; s <= POINT_SUM_MAX; s++){
+      // mixing again averages what the earlier mix made of each channel
+      int gray = pipeline->mixed ? (pipeline->sum[0][s] + pipeline->sum[1][s]
+                                    + pipeline->sum[2][s]) / POINT_CHANNELS 
+                                 : s / POINT_CHANNELS;
+      for(int c = 0; c < POINT_CHANNELS; c++){
+        pipeline->sum[c][s] = gray;
+      }
+    }
+    pipeline->mixed = true;
+  }
+
+  bool init_point_pipeline_from_spec(struct point_pipeline *pipeline, 
+                                     const char *spec){
+    if(spec == NULL){
+      printf("[!] no point operations given\n");
+      return false;
+    }
+    init_point_pipeline(pipeline);
+    while(true){
+      size_t length = strcspn(spec, ",");
+      int op = 0;
+      while(op < no_of_point_ops && 
+            (strlen(point_ops[op].name) != length || 
+             strncmp(spec, point_ops[op].name, length))){
+        op++;
+      }
+      if(op == no_of_point_ops){
+        printf("[!] point operation %.*s is not defined (expecting invert "
+               "or grayscale)\n", (int) length, spec);
+        return false;
+      }
+      point_ops[op].add(pipeline);
+      if(spec[length] == '\0'){
+        return true;
+      }
+      spec += length + 1;
+    }
+  }
+
+  bool point_pipeline_is_gray(const struct point_pipeline *pipeline){
+    return pipeline->mixed && 
+           !memcmp(pipeline->sum[0], pipeline->sum[1], POINT_SUM_MAX + 1) &&
+           !memcmp(pipeline->sum[0], pipeline->sum[2], POINT_SUM_MAX + 1);
+  }
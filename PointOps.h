@@ -0,0 +1,46 @@
+#ifndef POINT_OPS_H
+#define POINT_OPS_H
+
+#include "Utils.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+  // colour channels a point pipeline maps, and the largest sum of one 
+  // sample from each
+  #define POINT_CHANNELS 3
+  #define POINT_SUM_MAX (POINT_CHANNELS * 255)
+
+  // A run of per-pixel operations composed into lookup tables. Each colour
+  // sample of a pixel first goes through its channel's table; then, if the
+  // pipeline mixes channels, channel c becomes sum[c] of the three results
+  // added together. Any run of the supported operations reduces to this 
+  // form, so the pipeline is applied in one pass however long it is.
+  struct point_pipeline {
+    uint8_t channel[POINT_CHANNELS][256];
+    bool mixed;
+    uint8_t sum[POINT_CHANNELS][POINT_SUM_MAX + 1];
+  };
+
+  // initialise a pipeline that leaves pixels as they are
+  void init_point_pipeline(struct point_pipeline *pipeline);
+
+  // append a lookup table for each of the red, green and blue samples
+  void add_point_tables(struct point_pipeline *pipeline, 
+                        const uint8_t tables[POINT_CHANNELS][256]);
+
+  // append an inversion of every colour sample (as invert does)
+  void add_point_invert(struct point_pipeline *pipeline);
+
+  // append a conversion to gray, the mean of the colour samples (as 
+  // grayscale does)
+  void add_point_grayscale(struct point_pipeline *pipeline);
+
+  // initialise a pipeline from a comma-separated list of the operations 
+  // above by name ("invert" or "grayscale"), applied left to right
+  bool init_point_pipeline_from_spec(struct point_pipeline *pipeline, 
+                                     const char *spec);
+
+  // whether the pipeline makes every pixel gray (its samples all equal)
+  bool point_pipeline_is_gray(const struct point_pipeline *pipeline);
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <limits.h>
 #include "Utils.h"
 #include "Picture.h"
 #include "PicProcess.h"
@@ -12,7 +13,14 @@
     "rotate",
     "flip",
     "blur",
-    "parallel-blur"
+    "parallel-blur",
+    "simd-blur",
+    "convolve",
+    "gaussian-blur",
+    "median",
+    "point-ops",
+    "rotate-by",
+    "warp"
   };
 
 // -------------- picture transformation function wrappers -------------- \\
@@ -39,14 +47,356 @@
     flip_picture(pic, plane);
   }
 
-  void blur_picture_wrapper(struct picture *pic, const char *unused){
-    printf("calling blur\n");
-    blur_picture(pic);
+  // read the number at the start of text, which must be followed by the 
+  // end of text or one of the characters of ends (so "", "2x" and "abc" 
+  // are not numbers)
+  static bool read_double(const char *text, const char *ends, double *value){
+    char *end;
+    *value = strtod(text, &end);
+    return end != text && strchr(ends, *end) != NULL;
+  }
+
+  static bool read_int(const char *text, const char *ends, int *value){
+    char *end;
+    long number = strtol(text, &end, 10);
+    *value = (int) number;
+    return end != text && strchr(ends, *end) != NULL && 
+           number >= INT_MIN && number <= INT_MAX;
+  }
+
+  // blur radius and number of passes, given as an optional extra argument 
+  // of the form radius[:passes][@border] (default 1:1@copy), aborting if 
+  // either is malformed or out of range (a box may be as wide as the 
+  // picture, though bordered blurs are still held to KERNEL_MAX_RADIUS by
+  // their kernel)
+  static void blur_args(const char *extra_arg, struct picture *pic, 
+                        int *radius, int *passes){
+    *radius = 1;
+    *passes = 1;
+    if(extra_arg != NULL){
+      const char *sep = strchr(extra_arg, ':');
+      if(!read_int(extra_arg, ":@", radius) || 
+         (sep != NULL && !read_int(sep + 1, "@", passes))){
+        printf("[!] blur expects radius[:passes][@border], not %s\n", 
+               extra_arg);
+        clear_picture(pic);
+        exit(IO_ERROR);
+      }
+    }
+    int max_radius = pic->width > pic->height ? pic->width : pic->height;
+    if(*radius < 1 || *radius > max_radius){
+      printf("[!] blur is undefined for radius %i (must be 1 to %i for a "
+             "%ix%i picture)\n", *radius, max_radius, pic->width, 
+             pic->height);
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+    if(*passes < 1){
+      printf("[!] blur is undefined for %i passes (must be at least 1)\n", 
+             *passes);
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+  }
+
+  // names of the border modes, in enum border_mode order
+  static char *border_strings[] = {"copy", "clamp", "mirror", "wrap"};
+
+  // border mode given as an optional @mode suffix of extra_arg (default 
+  // copy), aborting on an unknown mode
+  static enum border_mode border_arg(const char *extra_arg, 
+                                     struct picture *pic){
+    const char *at = extra_arg == NULL ? NULL : strrchr(extra_arg, '@');
+    if(at == NULL){
+      return BORDER_COPY;
+    }
+    for(int mode = BORDER_COPY; mode <= BORDER_WRAP; mode++){
+      if(!strcmp(at + 1, border_strings[mode])){
+        return mode;
+      }
+    }
+    printf("[!] border mode %s is not defined (expecting copy, clamp, "
+           "mirror or wrap)\n", at + 1);
+    clear_picture(pic);
+    exit(IO_ERROR);
+  }
+
+  // kernel named by extra_arg (less any border mode), aborting if there is
+  // no such kernel
+  static void kernel_arg(struct convolution_kernel *kernel, 
+                         struct picture *pic, const char *extra_arg){
+    const char *at = extra_arg == NULL ? NULL : strrchr(extra_arg, '@');
+    size_t length = at != NULL ? (size_t) (at - extra_arg) 
+                               : (extra_arg == NULL ? 0 : strlen(extra_arg));
+    char spec[length + 1];
+    if(extra_arg != NULL){
+      memcpy(spec, extra_arg, length);
+    }
+    spec[length] = '\0';
+    if(!init_kernel_from_spec(kernel, extra_arg == NULL ? NULL : spec)){
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+  }
+
+  // box kernel of a blur radius, aborting on an invalid radius
+  static void box_kernel_arg(struct convolution_kernel *kernel, 
+                             struct picture *pic, int radius){
+    if(!init_box_kernel(kernel, radius)){
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+  }
+
+  void blur_picture_wrapper(struct picture *pic, const char *extra_arg){
+    int radius, passes;
+    blur_args(extra_arg, pic, &radius, &passes);
+    enum border_mode border = border_arg(extra_arg, pic);
+    printf("calling blur (%i:%i@%s)\n", radius, passes, 
+           border_strings[border]);
+    // repeated passes at the default radius are fused so the picture is 
+    // only streamed through once
+    if(radius == 1 && passes > 1 && border == BORDER_COPY){
+      fused_blur_picture(pic, passes);
+      return;
+    }
+    // wider plain box blurs need no kernel: the integral image costs the 
+    // same per pixel at any radius
+    if(radius > 1 && border == BORDER_COPY){
+      for(int i = 0; i < passes; i++){
+        integral_blur_picture(pic, radius);
+      }
+      return;
+    }
+    struct convolution_kernel box;
+    box_kernel_arg(&box, pic, radius);
+    for(int i = 0; i < passes; i++){
+      convolve_picture(pic, &box, border);
+    }
+    clear_kernel(&box);
   }
   
-  void parallel_blur_wrapper(struct picture *pic, const char *unused){
-    printf("calling parallel blur\n");
-    parallel_blur_picture(pic);
+  // thread count given as an optional extra argument (default one per core)
+  static int thread_count(const char *extra_arg){
+    return extra_arg == NULL ? 0 : atoi(extra_arg);
+  }
+
+  void parallel_blur_wrapper(struct picture *pic, const char *extra_arg){
+    int threads = thread_count(extra_arg);
+    printf("calling parallel blur (%i threads)\n", threads);
+    tiled_blur_picture(pic, threads);
+  }
+
+  void simd_blur_wrapper(struct picture *pic, const char *unused){
+    printf("calling simd blur (%s)\n", simd_blur_isa());
+    simd_blur_picture(pic);
+  }
+
+  void convolve_wrapper(struct picture *pic, const char *extra_arg){
+    printf("calling convolve (%s)\n", extra_arg);
+    enum border_mode border = border_arg(extra_arg, pic);
+    struct convolution_kernel kernel;
+    kernel_arg(&kernel, pic, extra_arg);
+    convolve_picture(pic, &kernel, border);
+    clear_kernel(&kernel);
+  }
+
+  // gaussian standard deviation given as the extra argument, aborting if 
+  // it is not a number (its range is checked by the blur itself)
+  static double sigma_arg(const char *extra_arg, struct picture *pic){
+    double sigma = 0;
+    if(extra_arg != NULL && !read_double(extra_arg, "", &sigma)){
+      printf("[!] gaussian-blur expects a sigma, not %s\n", extra_arg);
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+    return sigma;
+  }
+
+  void gaussian_blur_wrapper(struct picture *pic, const char *extra_arg){
+    double sigma = sigma_arg(extra_arg, pic);
+    printf("calling gaussian blur (%g)\n", sigma);
+    gaussian_blur_picture(pic, sigma);
+  }
+
+  // median radius given as an optional extra argument (default 1), 
+  // aborting if it is not a whole number (its range is checked by the 
+  // filter itself)
+  static int median_radius_arg(const char *extra_arg, struct picture *pic){
+    int radius = 1;
+    if(extra_arg != NULL && !read_int(extra_arg, "", &radius)){
+      printf("[!] median expects a radius, not %s\n", extra_arg);
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+    return radius;
+  }
+
+  void median_wrapper(struct picture *pic, const char *extra_arg){
+    int radius = median_radius_arg(extra_arg, pic);
+    printf("calling median (%i)\n", radius);
+    median_picture(pic, radius);
+  }
+
+  // point pipeline named by extra_arg, aborting if an operation is unknown
+  static void point_pipeline_arg(struct point_pipeline *pipeline, 
+                                 struct picture *pic, const char *extra_arg){
+    if(!init_point_pipeline_from_spec(pipeline, extra_arg)){
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+  }
+
+  void point_ops_wrapper(struct picture *pic, const char *extra_arg){
+    printf("calling point-ops (%s)\n", extra_arg);
+    struct point_pipeline pipeline;
+    point_pipeline_arg(&pipeline, pic, extra_arg);
+    point_ops_picture(pic, &pipeline);
+  }
+
+  // names of the sampling modes, in enum sample_mode order
+  static char *sample_strings[] = {"nearest", "bilinear"};
+
+  // sampling mode given as an optional @mode suffix of extra_arg (default 
+  // bilinear), aborting on an unknown mode
+  static enum sample_mode sample_arg(const char *extra_arg, 
+                                     struct picture *pic){
+    const char *at = extra_arg == NULL ? NULL : strrchr(extra_arg, '@');
+    if(at == NULL){
+      return SAMPLE_BILINEAR;
+    }
+    for(int mode = SAMPLE_NEAREST; mode <= SAMPLE_BILINEAR; mode++){
+      if(!strcmp(at + 1, sample_strings[mode])){
+        return mode;
+      }
+    }
+    printf("[!] sampling mode %s is not defined (expecting nearest or "
+           "bilinear)\n", at + 1);
+    clear_picture(pic);
+    exit(IO_ERROR);
+  }
+
+  void rotate_by_wrapper(struct picture *pic, const char *extra_arg){
+    double degrees = 0;
+    if(extra_arg != NULL && !read_double(extra_arg, "@", &degrees)){
+      printf("[!] rotate-by expects an angle in degrees, not %s\n", 
+             extra_arg);
+      clear_picture(pic);
+      exit(IO_ERROR);
+    }
+    enum sample_mode sampling = sample_arg(extra_arg, pic);
+    printf("calling rotate-by (%g@%s)\n", degrees, sample_strings[sampling]);
+    rotate_picture_by(pic, degrees, sampling);
+  }
+
+  // affine transform given as the six comma-separated coefficients 
+  // xx,xy,x0,yx,yy,y0 of extra_arg, aborting if any are missing
+  static void affine_arg(struct affine_transform *transform, 
+                         struct picture *pic, const char *extra_arg){
+    double *coefficients[] = {&transform->xx, &transform->xy, &transform->x0,
+                              &transform->yx, &transform->yy, &transform->y0};
+    const char *next = extra_arg;
+    for(int k = 0; k < 6; k++){
+      char *end = (char *) next;
+      if(next != NULL){
+        *coefficients[k] = strtod(next, &end);
+      }
+      if(next == NULL || end == next || 
+         (k < 5 ? *end != ',' : (*end != '\0' && *end != '@'))){
+        printf("[!] warp expects a transform of six coefficients "
+               "xx,xy,x0,yx,yy,y0\n");
+        clear_picture(pic);
+        exit(IO_ERROR);
+      }
+      next = end + 1;
+    }
+  }
+
+  void warp_wrapper(struct picture *pic, const char *extra_arg){
+    struct affine_transform transform;
+    affine_arg(&transform, pic, extra_arg);
+    enum sample_mode sampling = sample_arg(extra_arg, pic);
+    printf("calling warp (%g,%g,%g,%g,%g,%g@%s)\n", transform.xx, 
+           transform.xy, transform.x0, transform.yx, transform.yy, 
+           transform.y0, sample_strings[sampling]);
+    warp_picture(pic, &transform, sampling);
+  }
+
+  void invert_view_wrapper(struct picture_view *view, const char *unused){
+    printf("calling invert on region\n");
+    invert_view(view);
+  }
+
+  void grayscale_view_wrapper(struct picture_view *view, const char *unused){
+    printf("calling grayscale on region\n");
+    grayscale_view(view);
+  }
+
+  void blur_view_wrapper(struct picture_view *view, const char *extra_arg){
+    int radius, passes;
+    blur_args(extra_arg, view->parent, &radius, &passes);
+    enum border_mode border = border_arg(extra_arg, view->parent);
+    printf("calling blur (%i:%i@%s) on region\n", radius, passes, 
+           border_strings[border]);
+    if(radius == 1 && passes > 1 && border == BORDER_COPY){
+      fused_blur_view(view, passes);
+      return;
+    }
+    if(radius > 1 && border == BORDER_COPY){
+      for(int i = 0; i < passes; i++){
+        integral_blur_view(view, radius);
+      }
+      return;
+    }
+    struct convolution_kernel box;
+    box_kernel_arg(&box, view->parent, radius);
+    for(int i = 0; i < passes; i++){
+      convolve_view(view, &box, border);
+    }
+    clear_kernel(&box);
+  }
+
+  void parallel_blur_view_wrapper(struct picture_view *view, 
+                                  const char *extra_arg){
+    int threads = thread_count(extra_arg);
+    printf("calling parallel blur (%i threads) on region\n", threads);
+    tiled_blur_view(view, threads);
+  }
+
+  void simd_blur_view_wrapper(struct picture_view *view, const char *unused){
+    printf("calling simd blur (%s) on region\n", simd_blur_isa());
+    simd_blur_view(view);
+  }
+
+  void convolve_view_wrapper(struct picture_view *view, 
+                             const char *extra_arg){
+    printf("calling convolve (%s) on region\n", extra_arg);
+    enum border_mode border = border_arg(extra_arg, view->parent);
+    struct convolution_kernel kernel;
+    kernel_arg(&kernel, view->parent, extra_arg);
+    convolve_view(view, &kernel, border);
+    clear_kernel(&kernel);
+  }
+
+  void gaussian_blur_view_wrapper(struct picture_view *view, 
+                                  const char *extra_arg){
+    double sigma = sigma_arg(extra_arg, view->parent);
+    printf("calling gaussian blur (%g) on region\n", sigma);
+    gaussian_blur_view(view, sigma);
+  }
+
+  void median_view_wrapper(struct picture_view *view, const char *extra_arg){
+    int radius = median_radius_arg(extra_arg, view->parent);
+    printf("calling median (%i) on region\n", radius);
+    median_view(view, radius);
+  }
+
+  void point_ops_view_wrapper(struct picture_view *view, 
+                              const char *extra_arg){
+    printf("calling point-ops (%s) on region\n", extra_arg);
+    struct point_pipeline pipeline;
+    point_pipeline_arg(&pipeline, view->parent, extra_arg);
+    point_ops_view(view, &pipeline);
   }
 
 // ------------------------------------------------------------------------ \\
@@ -58,7 +408,31 @@
     rotate_picture_wrapper,
     flip_picture_wrapper,
     blur_picture_wrapper,
-    parallel_blur_wrapper
+    parallel_blur_wrapper,
+    simd_blur_wrapper,
+    convolve_wrapper,
+    gaussian_blur_wrapper,
+    median_wrapper,
+    point_ops_wrapper,
+    rotate_by_wrapper,
+    warp_wrapper
+  };
+
+  // region-limited versions of the above (NULL where a region is undefined)
+  static void (* const region_cmds[])(struct picture_view *, const char *) = { 
+    invert_view_wrapper,
+    grayscale_view_wrapper,
+    NULL,
+    NULL,
+    blur_view_wrapper,
+    parallel_blur_view_wrapper,
+    simd_blur_view_wrapper,
+    convolve_view_wrapper,
+    gaussian_blur_view_wrapper,
+    median_view_wrapper,
+    point_ops_view_wrapper,
+    NULL,
+    NULL
   };
 
   // size of look-up table (for safe IO error reporting)
@@ -81,10 +455,25 @@
       printf("[!] insufficient command line arguments provided\n");
       exit(IO_ERROR);
     }        
+
+    // region-limited processes take the region as "x y width height", 
+    // so a partial region (or anything after the extra argument) is an error
+    if(argc > 9 || argc == 6 || argc == 7){
+      printf("[!] a region must be given as all four of x y width height "
+             "(before any extra argument)\n");
+      exit(IO_ERROR);
+    }
+    bool has_region = argc >= 8;
+    if(has_region){
+      extra_arg = argv[8];
+    }
   
     printf("  filename  = %s\n", filename);
     printf("  target    = %s\n", target_file);
     printf("  process   = %s\n", process);
+    if(has_region){
+      printf("  region    = %s %s %s %s\n", argv[4], argv[5], argv[6], argv[7]);
+    }
     printf("  extra arg = %s\n", extra_arg);
   
     printf("\n");
@@ -109,12 +498,29 @@
     }
   
     // dispatch to appropriate picture transformation function
-    cmds[cmd_no](&pic, extra_arg);
+    if(has_region){
+      struct picture_view view;
+      if(region_cmds[cmd_no] == NULL){
+        printf("[!] %s is undefined for a region\n    aborting...\n", process);
+        clear_picture(&pic);
+        exit(IO_ERROR);
+      }
+      if(!init_picture_view(&view, &pic, atoi(argv[4]), atoi(argv[5]), 
+                            atoi(argv[6]), atoi(argv[7]))){
+        printf("[!] region does not lie within the picture\n    aborting...\n");
+        clear_picture(&pic);
+        exit(IO_ERROR);
+      }
+      region_cmds[cmd_no](&view, extra_arg);
+    } else {
+      cmds[cmd_no](&pic, extra_arg);
+    }
 
     // save resulting picture and report success
     save_picture_to_file(&pic, target_file);
     printf("-- picture processing complete --\n");
     
     clear_picture(&pic);
+    drain_buffer_pool();
     return 0;
   }
@@ -1,11 +1,212 @@
 #include "Utils.h"
+#include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <limits.h>
 
   #define DEFAULT_COMPRESSION_QUALITY -1
   #define FULL_COLOUR_CHANNELS 3
+  #define BUFFER_POOL_SLOTS 8
+  #define PTHREAD_CREATE_SUCCESS_CODE 0
+
+  // a free buffer held by the pool, with the image format it was sized for
+  struct pool_slot {
+    void *buffer;
+    int width;
+    int height;
+    int channels;
+  };
+
+  static struct pool_slot pool[BUFFER_POOL_SLOTS];
+  static struct buffer_pool_stats pool_stats;
+  static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+  // number of samples in a sod image (sod itself computes this as an int)
+  static size_t image_samples(sod_img img){
+    return (size_t) img.w * img.h * img.c;
+  }
+
+  // index of a sample in a sod image's planar float data
+  static size_t sample_index(sod_img img, int rgb, int x, int y){
+    return ((size_t) rgb * img.h + y) * img.w + x;
+  }
 
   sod_img create_image(int width, int height){
-    return sod_make_image(width, height, FULL_COLOUR_CHANNELS);   
+    sod_img img = sod_make_empty_image(width, height, FULL_COLOUR_CHANNELS);
+    img.data = calloc(image_samples(img), sizeof(float));
+    return img;
+  }
+
+  // whether buffers of this size are mapped rather than taken from the heap
+  static bool is_mapped_size(size_t size){
+  #if OUT_OF_CORE_THRESHOLD > 0
+    if(size >= OUT_OF_CORE_THRESHOLD){
+      return true;
+    }
+  #endif
+    return size >= HUGE_BUFFER_THRESHOLD;
+  }
+
+#if OUT_OF_CORE_THRESHOLD > 0
+
+  // map a buffer onto an unlinked temporary file in OUT_OF_CORE_DIR, so 
+  // the kernel can page it out to disk instead of holding it in RAM
+  static void *map_backing_file(size_t size){
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/picture-XXXXXX", OUT_OF_CORE_DIR);
+    int fd = mkstemp(path);
+    if(fd == IO_ERROR){
+      return MAP_FAILED;
+    }
+    // the file disappears with the mapping
+    unlink(path);
+    void *buffer = MAP_FAILED;
+    if(ftruncate(fd, size) == 0){
+      buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    return buffer;
+  }
+
+#endif
+
+  void *alloc_aligned_buffer(size_t size){
+  #if OUT_OF_CORE_THRESHOLD > 0
+    if(size >= OUT_OF_CORE_THRESHOLD){
+      // a new file reads back as zeroes
+      void *buffer = map_backing_file(size);
+      return buffer == MAP_FAILED ? NULL : buffer;
+    }
+  #endif
+    if(size >= HUGE_BUFFER_THRESHOLD){
+      // anonymous mappings are page aligned and arrive zeroed
+      void *buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, 
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(buffer == MAP_FAILED){
+        return NULL;
+      }
+    #ifdef MADV_HUGEPAGE
+      // only a hint: without huge page support the mapping keeps 4K pages
+      madvise(buffer, size, MADV_HUGEPAGE);
+    #endif
+      return buffer;
+    }
+    void *buffer = aligned_alloc(CACHE_LINE_SIZE, size);
+    if(buffer != NULL){
+      memset(buffer, 0, size);
+    }
+    return buffer;
+  }
+
+  void free_aligned_buffer(void *buffer, size_t size){
+    if(buffer == NULL){
+      return;
+    }
+    if(is_mapped_size(size)){
+      // hand the pages straight back to the OS
+      munmap(buffer, size);
+    } else {
+      free(buffer);
+    }
+  }
+
+  size_t padded_stride(size_t row_bytes){
+    return (row_bytes + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+  }
+
+  // size of the pooled buffer for a width x height image
+  static size_t pixel_buffer_size(int width, int height, int channels){
+    return padded_stride((size_t) width * channels) * height;
+  }
+
+  void *acquire_pixel_buffer(int width, int height, int channels, 
+                             bool zeroed){
+    size_t size = pixel_buffer_size(width, height, channels);
+    void *buffer = NULL;
+
+    // look for a free buffer of the same dimensions (mapped buffers are 
+    // never pooled)
+    if(is_mapped_size(size)){
+      pthread_mutex_lock(&pool_lock);
+      pool_stats.allocations++;
+      pthread_mutex_unlock(&pool_lock);
+      return alloc_aligned_buffer(size);
+    }
+    pthread_mutex_lock(&pool_lock);
+    for(int i = 0; i < BUFFER_POOL_SLOTS; i++){
+      struct pool_slot *slot = &pool[i];
+      if(slot->buffer != NULL && slot->width == width && 
+         slot->height == height && slot->channels == channels){
+        buffer = slot->buffer;
+        slot->buffer = NULL;
+        pool_stats.reuses++;
+        pool_stats.bytes_reused += size;
+        break;
+      }
+    }
+    if(buffer == NULL){
+      pool_stats.allocations++;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if(buffer == NULL){
+      return alloc_aligned_buffer(size);
+    }
+    if(zeroed){
+      memset(buffer, 0, size);
+    }
+    return buffer;
+  }
+
+  void release_pixel_buffer(void *buffer, int width, int height, 
+                            int channels){
+    // mapped buffers go straight back to the OS rather than sit in the pool
+    size_t size = pixel_buffer_size(width, height, channels);
+    if(is_mapped_size(size)){
+      free_aligned_buffer(buffer, size);
+      return;
+    }
+    pthread_mutex_lock(&pool_lock);
+    for(int i = 0; i < BUFFER_POOL_SLOTS; i++){
+      struct pool_slot *slot = &pool[i];
+      if(slot->buffer == NULL){
+        slot->buffer = buffer;
+        slot->width = width;
+        slot->height = height;
+        slot->channels = channels;
+        buffer = NULL;
+        break;
+      }
+    }
+    pthread_mutex_unlock(&pool_lock);
+    // pool is full
+    free_aligned_buffer(buffer, size);
+  }
+
+  void drain_buffer_pool(void){
+    pthread_mutex_lock(&pool_lock);
+    for(int i = 0; i < BUFFER_POOL_SLOTS; i++){
+      struct pool_slot *slot = &pool[i];
+      size_t size = pixel_buffer_size(slot->width, slot->height, 
+                                      slot->channels);
+      free_aligned_buffer(slot->buffer, size);
+      slot->buffer = NULL;
+    }
+    pthread_mutex_unlock(&pool_lock);
+  }
+
+  struct buffer_pool_stats get_buffer_pool_stats(void){
+    pthread_mutex_lock(&pool_lock);
+    struct buffer_pool_stats stats = pool_stats;
+    pthread_mutex_unlock(&pool_lock);
+    return stats;
+  }
+
+  void reset_buffer_pool_stats(void){
+    pthread_mutex_lock(&pool_lock);
+    pool_stats = (struct buffer_pool_stats) {0};
+    pthread_mutex_unlock(&pool_lock);
   }
 
   void free_image(sod_img img){
@@ -35,8 +236,40 @@
     return true;
   }
 
+  bool save_pixels(const uint8_t *pixels, size_t stride, int bpp, 
+                   int width, int height, const char *path){
+    // the encoder takes tightly packed RGB (or single-channel) rows
+    int channels = bpp == 1 ? 1 : FULL_COLOUR_CHANNELS;
+    size_t row_bytes = (size_t) width * channels;
+    uint8_t *blob = malloc(row_bytes * height);
+    if(blob == NULL){
+      printf("[!] error saving file to %s\n", path);
+      return false;
+    }
+    for(int y = 0; y < height; y++){
+      const uint8_t *row = pixels + y * stride;
+      uint8_t *out = blob + y * row_bytes;
+      for(int x = 0; x < width; x++){
+        memcpy(out + (size_t) x * channels, row + (size_t) x * bpp, channels);
+      }
+    }
+    int ret = sod_img_blob_save_as_jpeg(path, blob, width, height, channels,
+                                        DEFAULT_COMPRESSION_QUALITY);
+    free(blob);
+    if(ret != SOD_OK){
+      printf("[!] error saving file to %s\n", path);
+      return false;
+    }
+    return true;
+  }
+
   sod_img copy_image(sod_img img){
-    return sod_copy_image(img);   
+    sod_img copy = img;
+    copy.data = malloc(image_samples(img) * sizeof(float));
+    if(copy.data != NULL && img.data != NULL){
+      memcpy(copy.data, img.data, image_samples(img) * sizeof(float));
+    }
+    return copy;
   }
 
   int get_image_width(sod_img img){
@@ -48,12 +281,77 @@
   } 
 
   int get_pixel_value(sod_img img, int rgb, int x, int y){
-    float intensity = sod_img_get_pixel(img, x, y, rgb);
+    // clamp to the nearest edge pixel, as sod_img_get_pixel does
+    if(x < 0) x = 0;
+    if(x >= img.w) x = img.w - 1;
+    if(y < 0) y = 0;
+    if(y >= img.h) y = img.h - 1;
+    if(rgb < 0 || rgb >= img.c){
+      return 0;
+    }
+    float intensity = img.data[sample_index(img, rgb, x, y)];
     int rgb_value =  intensity * MAX_PIXEL_INTENSITY;
     return rgb_value;
   }
 
   void set_pixel_value(sod_img img, int rgb, int x, int y, int val){
+    if(x < 0 || y < 0 || rgb < 0 || x >= img.w || y >= img.h || rgb >= img.c){
+      return;
+    }
     float intensity = val / MAX_PIXEL_INTENSITY;  
-    sod_img_set_pixel(img, x, y, rgb, intensity);  
+    img.data[sample_index(img, rgb, x, y)] = intensity;
+  }
+
+  void image_to_pixels(sod_img img, uint8_t *pixels, size_t stride, int bpp){
+    size_t plane_size = (size_t) img.w * img.h;
+    for(int y = 0; y < img.h; y++){
+      uint8_t *row = pixels + y * stride;
+      for(int c = 0; c < img.c && c < bpp; c++){
+        const float *plane = img.data + c * plane_size + (size_t) y * img.w;
+        for(int x = 0; x < img.w; x++){
+          int rgb_value = plane[x] * MAX_PIXEL_INTENSITY;
+          row[x * bpp + c] = rgb_value;
+        }
+      }
+    }
+  }
+
+  void pixels_to_image(const uint8_t *pixels, size_t stride, int bpp, 
+                       sod_img img){
+    size_t plane_size = (size_t) img.w * img.h;
+    for(int y = 0; y < img.h; y++){
+      const uint8_t *row = pixels + y * stride;
+      for(int c = 0; c < img.c; c++){
+        float *plane = img.data + c * plane_size + (size_t) y * img.w;
+        // single-sample pixels are gray in every channel
+        int sample = bpp == 1 ? 0 : c;
+        for(int x = 0; x < img.w; x++){
+          float intensity = row[x * bpp + sample] / MAX_PIXEL_INTENSITY;
+          plane[x] = intensity;
+        }
+      }
+    }
+  }
+
+  int core_count(void){
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores < 1 ? 1 : (cores > INT_MAX ? INT_MAX : (int) cores);
+  }
+
+  bool run_workers(void *(*worker)(void *), void *args, int threads){
+    pthread_t *workers = malloc((threads - 1) * sizeof(pthread_t));
+    int started = 0;
+    while(workers != NULL && started < threads - 1 && 
+          pthread_create(&workers[started], NULL, worker, args) == 
+          PTHREAD_CREATE_SUCCESS_CODE){
+      started++;
+    }
+    bool done = worker(args) != WORKER_FAILED;
+    for(int w = 0; w < started; w++){
+      void *result;
+      pthread_join(workers[w], &result);
+      done = done && result != WORKER_FAILED;
+    }
+    free(workers);
+    return done;
   }
@@ -4,15 +4,71 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "sod.h"
 
   #define IO_ERROR -1
+  #define MEMORY_ERROR -2
   #define MAX_PIXEL_INTENSITY 255.0
+  #define CACHE_LINE_SIZE 64
+
+  // buffers of at least this many bytes are mapped directly from the OS 
+  // with transparent huge pages (override with -DHUGE_BUFFER_THRESHOLD=n)
+  #ifndef HUGE_BUFFER_THRESHOLD
+  #define HUGE_BUFFER_THRESHOLD (16 * 1024 * 1024)
+  #endif
+
+  // buffers of at least this many bytes live in a file-backed mapping in 
+  // OUT_OF_CORE_DIR, so they need not stay resident in RAM (0 disables; 
+  // e.g. -DOUT_OF_CORE_THRESHOLD=1073741824 -DOUT_OF_CORE_DIR=\"/scratch\")
+  #ifndef OUT_OF_CORE_THRESHOLD
+  #define OUT_OF_CORE_THRESHOLD 0
+  #endif
+  #ifndef OUT_OF_CORE_DIR
+  #define OUT_OF_CORE_DIR "/tmp"
+  #endif
 
   // Create a new instance of a sod image of the specified width 
   // and height, using the full RGB colour model.
   sod_img create_image(int width, int height);
   
+  // Allocate a zeroed pixel buffer of the given size (a multiple of 
+  // CACHE_LINE_SIZE) starting on a cache line boundary. Buffers of at 
+  // least HUGE_BUFFER_THRESHOLD bytes are anonymous mappings, backed by 
+  // huge pages where the kernel supports them, and buffers of at least 
+  // OUT_OF_CORE_THRESHOLD bytes are mappings of a temporary file.
+  void *alloc_aligned_buffer(size_t size);
+
+  // Free a buffer from alloc_aligned_buffer of the given size
+  void free_aligned_buffer(void *buffer, size_t size);
+
+  // Round a row length in bytes up to a whole number of cache lines
+  size_t padded_stride(size_t row_bytes);
+
+  // Take a cache line aligned buffer for a width x height image with the 
+  // given bytes per pixel (rows padded to padded_stride) from the buffer 
+  // pool, allocating one only if no buffer of those dimensions is free. 
+  // Recycled buffers are only zeroed if zeroed is set.
+  void *acquire_pixel_buffer(int width, int height, int channels, 
+                             bool zeroed);
+
+  // Return a buffer from acquire_pixel_buffer to the pool (it is freed 
+  // if the pool is full, and mapped buffers are always unmapped at once)
+  void release_pixel_buffer(void *buffer, int width, int height, 
+                            int channels);
+
+  // Free every buffer held by the pool
+  void drain_buffer_pool(void);
+
+  // Counters of buffer pool activity since the last reset
+  struct buffer_pool_stats {
+    size_t allocations;
+    size_t reuses;
+    size_t bytes_reused;
+  };
+  struct buffer_pool_stats get_buffer_pool_stats(void);
+  void reset_buffer_pool_stats(void);
+  
   // Free the memory used by sod image provided as argument
   void free_image(sod_img img);
   
@@ -21,6 +77,13 @@
   
   // Saves the given image in the given destination.
   bool save_image(sod_img img, const char *path);
+
+  // Saves the RGB samples of an interleaved 8-bit buffer with bpp bytes 
+  // per pixel and stride bytes per row in the given destination (no 
+  // intermediate float image is made). A buffer with one byte per pixel 
+  // is saved through the encoder's single-component path.
+  bool save_pixels(const uint8_t *pixels, size_t stride, int bpp, 
+                   int width, int height, const char *path);
     
   // Clones the image provided as argument
   sod_img copy_image(sod_img img);
@@ -39,4 +102,28 @@
   // NOTE: (rgb = 0 for red, rgb = 1 for green, rgb = 2 for blue)
   void set_pixel_value(sod_img img, int rgb, int x, int y, int val);
 
+  // Unpack the planar float image into an interleaved 8-bit buffer with
+  // bpp bytes per pixel and stride bytes per row (padding bytes untouched,
+  // and channels beyond bpp dropped).
+  // Intensities are converted exactly as get_pixel_value does.
+  void image_to_pixels(sod_img img, uint8_t *pixels, size_t stride, int bpp);
+
+  // Pack an interleaved 8-bit buffer into the planar float image (a buffer
+  // with one byte per pixel fills every channel).
+  // Intensities are converted exactly as set_pixel_value does.
+  void pixels_to_image(const uint8_t *pixels, size_t stride, int bpp, 
+                       sod_img img);
+
+  // Number of cores available to run threads on
+  int core_count(void);
+
+  // what a worker returns if it could not do its share of the work (e.g. 
+  // for want of memory), rather than NULL
+  #define WORKER_FAILED ((void *) 1)
+
+  // Run worker on the given number of threads, all sharing args (the 
+  // calling thread is one of them, so the work still completes if no more 
+  // threads can be created), returning false if any returned WORKER_FAILED
+  bool run_workers(void *(*worker)(void *), void *args, int threads);
+
 #endif
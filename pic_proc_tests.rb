@@ -103,6 +103,7 @@ else
   for blur_cnt in 2..10
     run_test("repeated blur test #{blur_cnt}", "need_glasses#{blur_cnt-1}.jpg need_glasses#{blur_cnt}.jpg blur", "need_glasses#{blur_cnt}.jpeg")  
   end
+  run_test("wide blur test", "test_images/test.jpg test_blur_100.jpg blur 100", "test_blur_100.jpeg")
   
   puts "----------------------------------------"
   puts "        Parallel Blur Test Cases        " 
@@ -116,6 +117,72 @@ else
     run_test("repeated parallel blur test #{blur_cnt}", "par-need_glasses#{blur_cnt-1}.jpg par-need_glasses#{blur_cnt}.jpg parallel-blur", "need_glasses#{blur_cnt}.jpeg")  
   end
   
+  puts "----------------------------------------"
+  puts "           Region Test Cases            " 
+  puts "----------------------------------------"
+  puts ""    
+  
+  run_test("whole region invert test", "test_images/test.jpg reg-test_inverted.jpg invert 0 0 640 384", "test_inverted.jpeg")
+  run_test("region invert test", "test_images/test.jpg test_region_invert.jpg invert 100 50 200 150", "test_region_invert.jpeg")
+  run_test("region blur test", "test_images/test.jpg test_region_blur.jpg blur 100 50 200 150 3", "test_region_blur.jpeg")
+  
+  puts "----------------------------------------"
+  puts "         Convolution Test Cases         " 
+  puts "----------------------------------------"
+  puts ""    
+  
+  run_test("convolve box test", "test_images/test.jpg conv-test_blur.jpg convolve box:1", "test_blur.jpeg")
+  run_test("convolve sharpen test", "test_images/test.jpg test_convolve_sharpen.jpg convolve sharpen", "test_convolve_sharpen.jpeg")
+  run_test("convolve kernel file test", "test_images/test.jpg file-test_blur.jpg convolve test_images/long_row_box_kernel.txt", "test_blur.jpeg")
+  
+  puts "----------------------------------------"
+  puts "         Border Mode Test Cases         " 
+  puts "----------------------------------------"
+  puts ""    
+  
+  run_test("copy border blur test", "test_images/test.jpg copy-test_blur.jpg blur 1@copy", "test_blur.jpeg")
+  run_test("clamp border blur test", "test_images/test.jpg test_blur_clamp.jpg blur 3@clamp", "test_blur_clamp.jpeg")
+  run_test("mirror border blur test", "test_images/test.jpg test_blur_mirror.jpg blur 3@mirror", "test_blur_mirror.jpeg")
+  run_test("wrap border blur test", "test_images/test.jpg test_blur_wrap.jpg blur 3@wrap", "test_blur_wrap.jpeg")
+  run_test("narrow mirror border blur test", "test_images/narrow.jpg test_narrow_blur_mirror.jpg blur 20@mirror", "test_narrow_blur_mirror.jpeg")
+  run_test("mirror border convolve test", "test_images/test.jpg test_convolve_gaussian.jpg convolve gaussian:1.5@mirror", "test_convolve_gaussian.jpeg")
+  
+  puts "----------------------------------------"
+  puts "        Gaussian Blur Test Cases        " 
+  puts "----------------------------------------"
+  puts ""    
+  
+  run_test("gaussian blur test", "test_images/test.jpg test_gaussian_blur.jpg gaussian-blur 2.5", "test_gaussian_blur.jpeg")
+  
+  puts "----------------------------------------"
+  puts "            Median Test Cases           " 
+  puts "----------------------------------------"
+  puts ""    
+  
+  run_test("median test", "test_images/test.jpg test_median.jpg median 2", "test_median.jpeg")
+  
+  puts "----------------------------------------"
+  puts "       Point Operation Test Cases       " 
+  puts "----------------------------------------"
+  puts ""    
+  
+  run_test("point-ops invert test", "test_images/test.jpg pops-test_inverted.jpg point-ops invert", "test_inverted.jpeg")
+  run_test("point-ops grayscale test", "test_images/test.jpg pops-test_grayscale.jpg point-ops grayscale", "test_grayscale.jpeg")
+  run_test("point-ops chain test", "test_images/test.jpg test_point_ops.jpg point-ops invert,grayscale,invert", "test_point_ops.jpeg")
+  
+  puts "----------------------------------------"
+  puts "             Warp Test Cases            " 
+  puts "----------------------------------------"
+  puts ""    
+  
+  run_test("rotate-by 90 test", "test_images/test.jpg by-test_rotate_90.jpg rotate-by 90", "test_rotate_90.jpeg")
+  run_test("rotate-by 180 test", "test_images/test.jpg by-test_rotate_180.jpg rotate-by 180", "test_rotate_180.jpeg")
+  run_test("rotate-by -90 test", "test_images/test.jpg by-test_rotate_270.jpg rotate-by -90", "test_rotate_270.jpeg")
+  run_test("rotate-by 30 test", "test_images/test.jpg test_rotate_by_30.jpg rotate-by 30", "test_rotate_by_30.jpeg")
+  run_test("rotate-by 30 nearest test", "test_images/test.jpg test_rotate_by_30_nearest.jpg rotate-by 30@nearest", "test_rotate_by_30_nearest.jpeg")
+  run_test("warp test", "test_images/test.jpg test_warp.jpg warp 1,0.2,-20,0.1,0.9,15", "test_warp.jpeg")
+  run_test("warp nearest test", "test_images/test.jpg test_warp_nearest.jpg warp 1,0.2,-20,0.1,0.9,15@nearest", "test_warp_nearest.jpeg")
+  
   puts "----------------------------------------"
   puts "           IO ERROR Test Cases          " 
   puts "----------------------------------------"
@@ -135,6 +202,41 @@ else
   
   run_test("flip arg error test", "test_images/test.jpg output.jpg flip O", nil, false)
   
+  run_test("region bounds error test", "test_images/test.jpg output.jpg invert 600 300 100 100", nil, false)
+  run_test("region process error test", "test_images/test.jpg output.jpg rotate 0 0 10 10 90", nil, false)
+  run_test("region partial error test 1", "test_images/test.jpg output.jpg invert 0 0", nil, false)
+  run_test("region partial error test 2", "test_images/test.jpg output.jpg invert 0 0 10", nil, false)
+  
+  run_test("convolve arg error test 1", "test_images/test.jpg output.jpg convolve", nil, false)
+  run_test("convolve arg error test 2", "test_images/test.jpg output.jpg convolve box:0", nil, false)
+  run_test("convolve arg error test 3", "test_images/test.jpg output.jpg convolve no_such_kernel.txt", nil, false)
+  run_test("convolve arg error test 4", "test_images/test.jpg output.jpg convolve pic_proc_tests.rb", nil, false)
+  
+  run_test("blur arg error test 1", "test_images/test.jpg output.jpg blur 2x", nil, false)
+  run_test("blur arg error test 2", "test_images/test.jpg output.jpg blur 2:x", nil, false)
+  run_test("blur arg error test 3", "test_images/test.jpg output.jpg blur 1000", nil, false)
+  
+  run_test("border arg error test 1", "test_images/test.jpg output.jpg blur 1@smudge", nil, false)
+  run_test("border arg error test 2", "test_images/test.jpg output.jpg convolve box:1@smudge", nil, false)
+  
+  run_test("gaussian blur arg error test 1", "test_images/test.jpg output.jpg gaussian-blur 0", nil, false)
+  run_test("gaussian blur arg error test 2", "test_images/test.jpg output.jpg gaussian-blur -1", nil, false)
+  run_test("gaussian blur arg error test 3", "test_images/test.jpg output.jpg gaussian-blur 2.5x", nil, false)
+  
+  run_test("median arg error test 1", "test_images/test.jpg output.jpg median 0", nil, false)
+  run_test("median arg error test 2", "test_images/test.jpg output.jpg median 1000", nil, false)
+  run_test("median arg error test 3", "test_images/test.jpg output.jpg median 2x", nil, false)
+  
+  run_test("point-ops arg error test 1", "test_images/test.jpg output.jpg point-ops", nil, false)
+  run_test("point-ops arg error test 2", "test_images/test.jpg output.jpg point-ops invert,sepia", nil, false)
+  
+  run_test("rotate-by arg error test 1", "test_images/test.jpg output.jpg rotate-by nan", nil, false)
+  run_test("rotate-by arg error test 2", "test_images/test.jpg output.jpg rotate-by 30@cubic", nil, false)
+  run_test("rotate-by arg error test 3", "test_images/test.jpg output.jpg rotate-by abc", nil, false)
+  run_test("warp arg error test 1", "test_images/test.jpg output.jpg warp", nil, false)
+  run_test("warp arg error test 2", "test_images/test.jpg output.jpg warp 1,0,0", nil, false)
+  run_test("warp arg error test 3", "test_images/test.jpg output.jpg warp 0,0,0,0,0,0", nil, false)
+  
   # clean up the files generated by the tests
   system %Q(make clean)
 end